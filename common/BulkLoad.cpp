@@ -0,0 +1,323 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : BulkLoad.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Implementation of bulk load session
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifdef IBPP_WINDOWS
+#include <windows.h>
+#include <io.h>
+#define fsync _commit
+#endif
+
+#ifdef IBPP_LINUX
+#include <unistd.h>
+#endif
+
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include "BulkLoad.h"
+
+// name as it is written in SQL, quoted unless it is a plain upper case one
+static std::string identifier(const std::string& name)
+{
+    bool plain = !name.empty() && name[0] >= 'A' && name[0] <= 'Z';
+    for (std::string::const_iterator c = name.begin(); plain && c != name.end(); ++c)
+        plain = (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '$';
+    if (plain)
+        return name;
+
+    std::string s("\"");
+    for (std::string::const_iterator c = name.begin(); c != name.end(); ++c)
+    {
+        if (*c == '"')
+            s += '"';
+        s += *c;
+    }
+    return s + "\"";
+}
+
+BulkLoad::BulkLoad(IBPP::Database db, const std::string& journal)
+    : dbM(db), journalM(journal)
+{
+}
+
+// first line of journal, so it is not applied to another database
+std::string BulkLoad::DatabaseId()
+{
+    return std::string("BULKLOAD ") + dbM->ServerName() + ":" + dbM->DatabaseName();
+}
+
+// journal: header line, then INDEX name or TRIGGER name on each line
+bool BulkLoad::ReadJournal()
+{
+    FILE *fp = fopen(journalM.c_str(), "r");
+    if (!fp)
+        return false;
+
+    std::string line;
+    bool first = true;
+    bool ok = true;
+    int c;
+    while (ok && (c = fgetc(fp)) != EOF)
+    {
+        if (c != '\n')
+        {
+            line += (char)c;
+            continue;
+        }
+        if (first)
+        {
+            ok = (line == DatabaseId());
+            if (!ok)
+                fprintf(stderr, "Journal %s belongs to another database (%s).\n",
+                    journalM.c_str(), line.c_str());
+        }
+        else if (line.compare(0, 6, "INDEX ") == 0)
+            indexesM.push_back(line.substr(6));
+        else if (line.compare(0, 8, "TRIGGER ") == 0)
+            triggersM.push_back(line.substr(8));
+        first = false;
+        line.erase();
+    }
+    fclose(fp);
+    return ok;     // line without newline was not written completely
+}
+
+// appends objects to journal and makes sure they are on disk before
+// anything is changed in database
+bool BulkLoad::WriteJournal(const std::vector<std::string>& indexes,
+    const std::vector<std::string>& triggers)
+{
+    FILE *fp = fopen(journalM.c_str(), "a");
+    if (!fp)
+    {
+        fprintf(stderr, "Cannot write journal: %s.\n", journalM.c_str());
+        return false;
+    }
+    if (ftell(fp) == 0)
+        fprintf(fp, "%s\n", DatabaseId().c_str());
+    for (size_t i = 0; i < indexes.size(); i++)
+        fprintf(fp, "INDEX %s\n", indexes[i].c_str());
+    for (size_t i = 0; i < triggers.size(); i++)
+        fprintf(fp, "TRIGGER %s\n", triggers[i].c_str());
+
+    bool ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+    if (fclose(fp) != 0 || !ok)
+    {
+        fprintf(stderr, "Cannot write journal: %s.\n", journalM.c_str());
+        return false;
+    }
+    return true;
+}
+
+// runs query with one string parameter (unless it is empty), returns the
+// first column of result
+void BulkLoad::Names(const std::string& sql, const std::string& param,
+    std::vector<std::string>& names)
+{
+    IBPP::Transaction tr = IBPP::TransactionFactory(dbM, IBPP::amRead);
+    tr->Start();
+    IBPP::Statement st = IBPP::StatementFactory(dbM, tr);
+    st->Prepare(sql);
+    if (!param.empty())
+        st->Set(1, param);
+    st->Execute();
+    while (st->Fetch())
+    {
+        std::string s;
+        st->Get(1, s);
+        s.erase(s.find_last_not_of(" ") + 1);
+        names.push_back(s);
+    }
+    tr->Commit();
+}
+
+// all objects are deactivated in one transaction, so either all of them
+// are or none is
+bool BulkLoad::Deactivate(const std::vector<std::string>& indexes,
+    const std::vector<std::string>& triggers)
+{
+    if (indexes.empty() && triggers.empty())
+        return true;
+    if (!WriteJournal(indexes, triggers))
+        return false;
+
+    IBPP::Transaction tr = IBPP::TransactionFactory(dbM);
+    tr->Start();
+    try
+    {
+        IBPP::Statement st = IBPP::StatementFactory(dbM, tr);
+        for (size_t i = 0; i < indexes.size(); i++)
+            st->ExecuteImmediate("ALTER INDEX " + identifier(indexes[i]) + " INACTIVE");
+        for (size_t i = 0; i < triggers.size(); i++)
+            st->ExecuteImmediate("ALTER TRIGGER " + identifier(triggers[i]) + " INACTIVE");
+        tr->Commit();
+    }
+    catch (IBPP::Exception &e)
+    {
+        tr->Rollback();
+        fprintf(stderr, "\nERROR!\n%s", e.ErrorMessage());
+        return false;
+    }
+    indexesM.insert(indexesM.end(), indexes.begin(), indexes.end());
+    triggersM.insert(triggersM.end(), triggers.begin(), triggers.end());
+    return true;
+}
+
+bool BulkLoad::DisableIndexes(const std::string& table)
+{
+    std::vector<std::string> indexes;
+    Names("select i.rdb$index_name from rdb$indices i "
+        "where i.rdb$relation_name = ? "
+        "and (i.rdb$index_inactive is null or i.rdb$index_inactive = 0) "
+        "and (i.rdb$system_flag is null or i.rdb$system_flag = 0) "
+        "and not exists (select 1 from rdb$relation_constraints c "
+        "where c.rdb$index_name = i.rdb$index_name)", table, indexes);
+    fprintf(stderr, "Deactivating %d indexes of %s...", (int)indexes.size(), table.c_str());
+    if (!Deactivate(indexes, std::vector<std::string>()))
+        return false;
+    fprintf(stderr, "done.\n");
+    return true;
+}
+
+bool BulkLoad::DisableTriggers(const std::string& table)
+{
+    std::vector<std::string> triggers;
+    Names(std::string("select rdb$trigger_name from rdb$triggers where "
+        "(rdb$system_flag is null or rdb$system_flag = 0) and "
+        "(rdb$trigger_inactive is null or rdb$trigger_inactive = 0)")
+        + (table.empty() ? "" : " and rdb$relation_name = ?"), table, triggers);
+    fprintf(stderr, "Deactivating %d triggers...", (int)triggers.size());
+    if (!Deactivate(std::vector<std::string>(), triggers))
+        return false;
+    fprintf(stderr, "done.\n");
+    return true;
+}
+
+// true if object exists and is inactive, objects dropped meanwhile are
+// skipped
+bool BulkLoad::Inactive(const std::string& sql, const std::string& name)
+{
+    std::vector<std::string> found;
+    Names(sql, name, found);
+    return !found.empty();
+}
+
+bool BulkLoad::Restore()
+{
+    if (indexesM.empty() && triggersM.empty())
+    {
+        remove(journalM.c_str());
+        return true;
+    }
+
+    // each object in its own transaction: i.e. unique index cannot be
+    // activated if loaded data has duplicates, that should not stop others
+    std::vector<std::string> failed;
+    std::vector<std::string> rebuilt;
+    fprintf(stderr, "Activating %d indexes and %d triggers...",
+        (int)indexesM.size(), (int)triggersM.size());
+    for (size_t i = 0; i < indexesM.size() + triggersM.size(); i++)
+    {
+        bool index = (i < indexesM.size());
+        const std::string& name = (index ? indexesM[i] : triggersM[i - indexesM.size()]);
+        std::string sql = (index ? "ALTER INDEX " : "ALTER TRIGGER ") + identifier(name) + " ACTIVE";
+        try
+        {
+            if (index && !Inactive("select 1 from rdb$indices where "
+                "rdb$index_name = ? and rdb$index_inactive = 1", name))
+            {
+                continue;
+            }
+            if (!index && !Inactive("select 1 from rdb$triggers where "
+                "rdb$trigger_name = ? and rdb$trigger_inactive = 1", name))
+            {
+                continue;
+            }
+            IBPP::Transaction tr = IBPP::TransactionFactory(dbM);
+            tr->Start();
+            IBPP::Statement st = IBPP::StatementFactory(dbM, tr);
+            st->ExecuteImmediate(sql);
+            tr->Commit();
+            if (index)
+                rebuilt.push_back(name);
+        }
+        catch (IBPP::Exception &e)
+        {
+            fprintf(stderr, "\nERROR!\n%s", e.ErrorMessage());
+            failed.push_back(sql);
+        }
+    }
+    fprintf(stderr, "done.\n");
+
+    fprintf(stderr, "Updating statistics of %d indexes...", (int)rebuilt.size());
+    for (size_t i = 0; i < rebuilt.size(); i++)
+    {
+        try
+        {
+            IBPP::Transaction tr = IBPP::TransactionFactory(dbM);
+            tr->Start();
+            IBPP::Statement st = IBPP::StatementFactory(dbM, tr);
+            st->ExecuteImmediate("SET STATISTICS INDEX " + identifier(rebuilt[i]));
+            tr->Commit();
+        }
+        catch (IBPP::Exception &e)      // not worth keeping the journal
+        {
+            fprintf(stderr, "\nERROR!\n%s", e.ErrorMessage());
+        }
+    }
+    fprintf(stderr, "done.\n");
+
+    if (!failed.empty())
+    {
+        fprintf(stderr, "\nSome objects could not get activated! Please run the "
+            "following statements manually,\nor run again with the same journal "
+            "(%s):\n", journalM.c_str());
+        for (size_t i = 0; i < failed.size(); i++)
+            fprintf(stderr, "%s;\n", failed[i].c_str());
+        return false;
+    }
+    remove(journalM.c_str());
+    indexesM.clear();
+    triggersM.clear();
+    return true;
+}
+
+bool BulkLoad::Recover()
+{
+    FILE *fp = fopen(journalM.c_str(), "r");
+    if (!fp)
+        return true;        // previous run finished
+    fclose(fp);
+
+    fprintf(stderr, "Found journal of bulk load that did not finish: %s\n",
+        journalM.c_str());
+    if (!ReadJournal())
+        return false;
+    return Restore();
+}
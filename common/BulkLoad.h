@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : BulkLoad.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Bulk load session: deactivates indexes and triggers of
+//                target tables for the load, with a journal for recovery.
+//                Shared by FBExport and FBCopy
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef BulkLoadH
+#define BulkLoadH
+
+#include <string>
+#include <vector>
+#include "ibpp.h"
+
+#define BULK_JOURNAL_DEFAULT "bulkload.journal"
+
+// Indexes that do not belong to constraints (and triggers, if asked) are
+// deactivated for the time of load and activated afterwards, which rebuilds
+// each index in one pass instead of updating it for every row. Objects are
+// written to the journal file before they are deactivated, so if a run dies
+// the next one with the same journal can put them back (see Recover)
+class BulkLoad
+{
+private:
+    IBPP::Database dbM;
+    std::string journalM;
+    std::vector<std::string> indexesM;
+    std::vector<std::string> triggersM;
+
+    std::string DatabaseId();
+    bool ReadJournal();
+    bool WriteJournal(const std::vector<std::string>& indexes,
+        const std::vector<std::string>& triggers);
+    void Names(const std::string& sql, const std::string& param,
+        std::vector<std::string>& names);
+    bool Deactivate(const std::vector<std::string>& indexes,
+        const std::vector<std::string>& triggers);
+    bool Inactive(const std::string& sql, const std::string& name);
+
+public:
+    BulkLoad(IBPP::Database db, const std::string& journal);
+
+    // restores what an earlier run with this journal left inactive. Returns
+    // false if something could not be restored
+    bool Recover();
+
+    // deactivate indexes of table, or its triggers (all triggers of database
+    // if table is empty). Return false on error
+    bool DisableIndexes(const std::string& table);
+    bool DisableTriggers(const std::string& table);
+
+    // activates everything again, updates statistics of indexes and removes
+    // journal. If something fails, journal is kept and false is returned
+    bool Restore();
+};
+
+#endif
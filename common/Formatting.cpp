@@ -0,0 +1,359 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : Formatting.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Fast conversion of numbers, dates and times to text
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include "Formatting.h"
+
+void appendInt(std::string& dest, int64_t value)
+{
+    char buff[24];
+    char *end = std::to_chars(buff, buff + sizeof(buff), value).ptr;
+    dest.append(buff, end - buff);
+}
+
+void appendScaled(std::string& dest, int64_t value, int scale)
+{
+    if (scale <= 0)
+    {
+        appendInt(dest, value);
+        return;
+    }
+
+    char buff[24];
+    uint64_t abs = (value < 0 ? 0 - (uint64_t)value : (uint64_t)value);
+    int digits = (int)(std::to_chars(buff, buff + sizeof(buff), abs).ptr - buff);
+    if (value < 0)
+        dest += '-';
+    if (digits <= scale)
+    {
+        dest += "0.";
+        dest.append(scale - digits, '0');
+        dest.append(buff, digits);
+    }
+    else
+    {
+        dest.append(buff, digits - scale);
+        dest += '.';
+        dest.append(buff + digits - scale, scale);
+    }
+}
+
+void appendFloat(std::string& dest, float value)
+{
+    char buff[32];
+    char *end = std::to_chars(buff, buff + sizeof(buff), value).ptr;
+    dest.append(buff, end - buff);
+}
+
+void appendDouble(std::string& dest, double value)
+{
+    char buff[32];
+    char *end = std::to_chars(buff, buff + sizeof(buff), value).ptr;
+    dest.append(buff, end - buff);
+}
+
+void appendPadded(std::string& dest, int value, int width)
+{
+    if (width == 2 && value >= 0 && value < 100)    // most common case
+    {
+        dest += (char)('0' + value / 10);
+        dest += (char)('0' + value % 10);
+        return;
+    }
+    char buff[16];
+    int digits = (int)(std::to_chars(buff, buff + sizeof(buff), value).ptr - buff);
+    if (digits < width)
+        dest.append(width - digits, '0');
+    dest.append(buff, digits);
+}
+
+// removes spaces around the value
+static void trimSpaces(const char *& data, size_t& len)
+{
+    while (len > 0 && *data == ' ')
+    {
+        data++;
+        len--;
+    }
+    while (len > 0 && data[len - 1] == ' ')
+        len--;
+}
+
+bool parseScaled(const char *data, size_t len, int scale, int64_t& value)
+{
+    trimSpaces(data, len);
+    const char *end = data + len;
+    bool negative = false;
+    if (data < end && (*data == '-' || *data == '+'))
+        negative = (*data++ == '-');
+
+    uint64_t limit = (uint64_t)INT64_MAX + (negative ? 1 : 0);
+    uint64_t v = 0;
+    int digits = 0;
+    int decimals = -1;      // -1 = no decimal point yet
+    for (; data < end; data++)
+    {
+        if (*data == '.' && decimals < 0)
+        {
+            decimals = 0;
+            continue;
+        }
+        if (*data < '0' || *data > '9')
+            return false;
+        digits++;
+        if (decimals >= 0 && ++decimals > scale)
+        {
+            if (*data != '0')
+                return false;
+            continue;
+        }
+        unsigned digit = *data - '0';
+        if (v > (limit - digit) / 10)
+            return false;
+        v = v * 10 + digit;
+    }
+    if (digits == 0)
+        return false;
+
+    for (int d = (decimals < 0 ? 0 : decimals); d < scale; d++)
+    {
+        if (v > limit / 10)
+            return false;
+        v *= 10;
+    }
+    value = (negative ? (int64_t)(0 - v) : (int64_t)v);
+    return true;
+}
+
+bool parseDouble(const char *data, size_t len, double& value)
+{
+    trimSpaces(data, len);
+    if (len > 0 && *data == '+')    // from_chars does not take it
+    {
+        data++;
+        len--;
+    }
+    std::from_chars_result r = std::from_chars(data, data + len, value);
+    return (len > 0 && r.ec == std::errc() && r.ptr == data + len);
+}
+
+DateTimeFormat::DateTimeFormat()
+{
+}
+
+DateTimeFormat::DateTimeFormat(const std::string& dateFormat,
+    const std::string& timeFormat, const std::string& separator)
+{
+    Set(dateFormat, timeFormat, separator);
+}
+
+void DateTimeFormat::Set(const std::string& dateFormat,
+    const std::string& timeFormat, const std::string& separator)
+{
+    Compile(dateFormat, "DMY", dateM);
+    Compile(timeFormat, "HMS", timeM);
+    separatorM = separator;
+}
+
+// fields are letters for values 0, 1 and 2
+void DateTimeFormat::Compile(const std::string& format, const char *fields,
+    std::vector<Op>& ops)
+{
+    ops.clear();
+    for (std::string::const_iterator c = format.begin(); c != format.end(); ++c)
+    {
+        Op op;
+        op.arg = -1;
+        op.width = 1;
+        op.modulo = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            if (*c == fields[i])
+            {
+                op.arg = i;
+                op.width = (fields[i] == 'Y' ? 4 : 2);
+            }
+            else if (*c == fields[i] - 'A' + 'a')
+            {
+                op.arg = i;
+                if (fields[i] == 'Y')
+                {
+                    op.width = 2;
+                    op.modulo = 100;
+                }
+            }
+        }
+
+        if (op.arg != -1)
+            ops.push_back(op);
+        else if (!ops.empty() && ops.back().arg == -1)
+            ops.back().text += *c;
+        else
+        {
+            op.text = *c;
+            ops.push_back(op);
+        }
+    }
+}
+
+void DateTimeFormat::Append(std::string& dest, const std::vector<Op>& ops,
+    const int *values)
+{
+    for (std::vector<Op>::const_iterator op = ops.begin(); op != ops.end(); ++op)
+    {
+        if (op->arg == -1)
+            dest += op->text;
+        else if (op->modulo)
+            appendPadded(dest, values[op->arg] % op->modulo, op->width);
+        else
+            appendPadded(dest, values[op->arg], op->width);
+    }
+}
+
+// invalid dates are not written at all
+void DateTimeFormat::AppendDate(std::string& dest, int date) const
+{
+    int values[3];      // day, month, year
+    if (IBPP::dtoi(date, &values[2], &values[1], &values[0]))
+        Append(dest, dateM, values);
+}
+
+void DateTimeFormat::AppendTime(std::string& dest, int time) const
+{
+    int values[3];      // hour, minute, second
+    int subseconds;
+    IBPP::ttoi(time, &values[0], &values[1], &values[2], &subseconds);
+    Append(dest, timeM, values);
+}
+
+void DateTimeFormat::AppendTimestamp(std::string& dest, int date, int time) const
+{
+    AppendDate(dest, date);
+    if (!timeM.empty())
+    {
+        dest += separatorM;
+        AppendTime(dest, time);
+    }
+}
+
+// returns the number of characters used, 0 if text does not match. Number
+// followed by another number (i.e. DDMMYY) is read with fixed width
+size_t DateTimeFormat::Parse(const char *data, size_t len,
+    const std::vector<Op>& ops, int *values)
+{
+    size_t pos = 0;
+    for (std::vector<Op>::const_iterator op = ops.begin(); op != ops.end(); ++op)
+    {
+        if (op->arg == -1)
+        {
+            if (len - pos < op->text.length()
+                || op->text.compare(0, std::string::npos, data + pos,
+                    op->text.length()) != 0)
+            {
+                return 0;
+            }
+            pos += op->text.length();
+            continue;
+        }
+
+        std::vector<Op>::const_iterator next = op + 1;
+        size_t maxDigits = (next != ops.end() && next->arg != -1 ? op->width : 9);
+        size_t digits = 0;
+        int v = 0;
+        while (pos < len && digits < maxDigits && data[pos] >= '0' && data[pos] <= '9')
+        {
+            v = v * 10 + (data[pos++] - '0');
+            digits++;
+        }
+        if (digits == 0)
+            return 0;
+        if (op->modulo)
+            v += (v < 50 ? 2000 : 1900);
+        values[op->arg] = v;
+    }
+    return pos;
+}
+
+bool DateTimeFormat::ParseDate(const char *data, size_t len, int& date) const
+{
+    trimSpaces(data, len);
+    int values[3] = { 1, 1, 1900 };     // day, month, year
+    if (len == 0 || Parse(data, len, dateM, values) != len
+        || !IBPP::itod(&date, values[2], values[1], values[0]))
+    {
+        return false;
+    }
+    int y, m, d;        // itod() takes i.e. 31.02. as 03.03.
+    IBPP::dtoi(date, &y, &m, &d);
+    return (y == values[2] && m == values[1] && d == values[0]);
+}
+
+// fraction of second may follow, as written by other tools
+bool DateTimeFormat::ParseTime(const char *data, size_t len, int& time) const
+{
+    trimSpaces(data, len);
+    int values[3] = { 0, 0, 0 };        // hour, minute, second
+    size_t used = Parse(data, len, timeM, values);
+    if (used == 0 || values[0] > 23 || values[1] > 59 || values[2] > 59)
+        return false;
+
+    int subseconds = 0;
+    if (used < len && data[used] == '.')
+    {
+        int scale = 1000;
+        for (used++; used < len && data[used] >= '0' && data[used] <= '9'; used++)
+        {
+            subseconds += (data[used] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (used != len)
+        return false;
+    IBPP::itot(&time, values[0], values[1], values[2], subseconds);
+    return true;
+}
+
+bool DateTimeFormat::ParseTimestamp(const char *data, size_t len, int& date,
+    int& time) const
+{
+    trimSpaces(data, len);
+    const char *sep = std::search(data, data + len, separatorM.begin(),
+        separatorM.end());
+    if (separatorM.empty() || sep == data + len)
+    {
+        time = 0;
+        return ParseDate(data, len, date);
+    }
+    const char *t = sep + separatorM.length();
+    return ParseDate(data, sep - data, date)
+        && ParseTime(t, data + len - t, time);
+}
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : Formatting.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Fast conversion of numbers, dates and times to text,
+//                shared by FBExport and FBCopy. Also parsing of the same
+//                text back, used by CSV import
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef FormattingH
+#define FormattingH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// numbers are appended to dest. Floats are written in the shortest form
+// that reads back as the same value
+void appendInt(std::string& dest, int64_t value);
+void appendScaled(std::string& dest, int64_t value, int scale);    // value / 10^scale
+void appendFloat(std::string& dest, float value);
+void appendDouble(std::string& dest, double value);
+void appendPadded(std::string& dest, int value, int width);        // leading zeros
+
+// text to numbers, surrounding spaces are ignored. Return false if text is
+// not a number or it does not fit. parseScaled gives value * 10^scale and
+// fails if more decimals than scale are given (unless they are zeros)
+bool parseScaled(const char *data, size_t len, int scale, int64_t& value);
+bool parseDouble(const char *data, size_t len, double& value);
+
+// Date and time formats (-J and -K switches) compiled into a list of
+// operations, so format string is not parsed for every value.
+// Date: D = day, M = month, Y = year (4 digits), y = year (2 digits)
+// Time: H = hour, M = minute, S = second
+// Upper case letters are padded with zeros to two digits, lower case are
+// not. Other characters are copied as they are.
+class DateTimeFormat
+{
+private:
+    struct Op
+    {
+        int arg;            // index of value, -1 for text
+        int width;          // minimal number of digits
+        int modulo;         // used for 2 digit year, 0 = none
+        std::string text;
+    };
+    std::vector<Op> dateM;
+    std::vector<Op> timeM;
+    std::string separatorM;     // between date and time of timestamp
+
+    static void Compile(const std::string& format, const char *fields,
+        std::vector<Op>& ops);
+    static void Append(std::string& dest, const std::vector<Op>& ops,
+        const int *values);
+    static size_t Parse(const char *data, size_t len, const std::vector<Op>& ops,
+        int *values);
+
+public:
+    DateTimeFormat();
+    DateTimeFormat(const std::string& dateFormat, const std::string& timeFormat,
+        const std::string& separator);
+    void Set(const std::string& dateFormat, const std::string& timeFormat,
+        const std::string& separator);
+
+    // values are those of IBPP::Date and IBPP::Time
+    void AppendDate(std::string& dest, int date) const;
+    void AppendTime(std::string& dest, int time) const;
+    void AppendTimestamp(std::string& dest, int date, int time) const;
+
+    // inverse of the above, return false if text does not match the format
+    // or it is not a valid date/time. Timestamp without time part is allowed
+    bool ParseDate(const char *data, size_t len, int& date) const;
+    bool ParseTime(const char *data, size_t len, int& time) const;
+    bool ParseTimestamp(const char *data, size_t len, int& date, int& time) const;
+};
+
+#endif
@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : TextKernels.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Vectorized scanning and escaping of text values
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+#include "TextKernels.h"
+
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+
+#ifdef __AVX2__
+#define VECTOR_BYTES 32
+typedef __m256i Vector;
+typedef unsigned int Mask;
+static inline Vector load(const char *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline Vector splat(char c) { return _mm256_set1_epi8(c); }
+static inline Vector equal(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Vector either(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+static inline Mask mask(Vector v) { return (Mask)_mm256_movemask_epi8(v); }
+#define ALL_BITS 0xFFFFFFFFu
+#else
+#define VECTOR_BYTES 16
+typedef __m128i Vector;
+typedef unsigned int Mask;
+static inline Vector load(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline Vector splat(char c) { return _mm_set1_epi8(c); }
+static inline Vector equal(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+static inline Vector either(Vector a, Vector b) { return _mm_or_si128(a, b); }
+static inline Mask mask(Vector v) { return (Mask)_mm_movemask_epi8(v); }
+#define ALL_BITS 0xFFFFu
+#endif
+#endif
+
+size_t trimmedLength(const char *data, size_t len)
+{
+#ifdef VECTOR_BYTES
+    Vector space = splat(' ');
+    while (len >= VECTOR_BYTES)
+    {
+        Mask m = mask(equal(load(data + len - VECTOR_BYTES), space)) ^ ALL_BITS;
+        if (m)      // highest bit is the last non-space character
+            return len - VECTOR_BYTES + (31 - __builtin_clz(m)) + 1;
+        len -= VECTOR_BYTES;
+    }
+#endif
+    while (len > 0 && data[len - 1] == ' ')
+        len--;
+    return len;
+}
+
+size_t findAny(const char *data, size_t len, const char *set)
+{
+    size_t count = strlen(set);
+    if (count == 0)             // nothing to look for
+        return len;
+    size_t pos = 0;
+#ifdef VECTOR_BYTES
+    Vector chars[4];
+    for (size_t i = 0; i < count && i < 4; i++)
+        chars[i] = splat(set[i]);
+    for (; pos + VECTOR_BYTES <= len; pos += VECTOR_BYTES)
+    {
+        Vector v = load(data + pos);
+        Vector found = equal(v, chars[0]);
+        for (size_t i = 1; i < count && i < 4; i++)
+            found = either(found, equal(v, chars[i]));
+        Mask m = mask(found);
+        if (m)
+            return pos + __builtin_ctz(m);
+    }
+#endif
+    for (; pos < len; pos++)
+        if (memchr(set, data[pos], count))
+            return pos;
+    return len;
+}
+
+void appendQuoted(std::string& dest, const char *data, size_t len, char quote)
+{
+    char set[2] = { quote, 0 };
+    dest.reserve(dest.length() + len + 2);
+    dest += quote;
+    while (true)
+    {
+        size_t next = findAny(data, len, set);
+        dest.append(data, next);
+        if (next == len)
+            break;
+        dest += quote;      // doubled
+        dest += quote;
+        data += next + 1;
+        len -= next + 1;
+    }
+    dest += quote;
+}
+
+void appendHtml(std::string& dest, const char *data, size_t len)
+{
+    dest.reserve(dest.length() + len);
+    while (true)
+    {
+        size_t next = findAny(data, len, "&<>\"");
+        dest.append(data, next);
+        if (next == len)
+            break;
+        switch (data[next])
+        {
+            case '&':   dest += "&amp;";    break;
+            case '<':   dest += "&lt;";     break;
+            case '>':   dest += "&gt;";     break;
+            default:    dest += "&quot;";   break;
+        }
+        data += next + 1;
+        len -= next + 1;
+    }
+}
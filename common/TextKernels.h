@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : TextKernels.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Vectorized scanning and escaping of text values for
+//                CSV, INSERT and HTML output
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef TextKernelsH
+#define TextKernelsH
+
+#include <stddef.h>
+#include <string>
+
+// Scanning and escaping of text values. They process 16 (SSE2) or 32 (AVX2,
+// when compiled with -mavx2) bytes at a time on x86 with GCC, and one byte
+// at a time elsewhere. Escaped text is appended to dest in a single pass.
+
+// length of data without trailing spaces (padding of CHAR columns)
+size_t trimmedLength(const char *data, size_t len);
+
+// position of first character from set (up to 4 chars), len if none
+size_t findAny(const char *data, size_t len, const char *set);
+
+// appends quote, data with each quote doubled, and quote again
+// used for CSV ("") and SQL ('') string literals
+void appendQuoted(std::string& dest, const char *data, size_t len, char quote);
+
+// appends data with & < > " replaced by HTML entities
+void appendHtml(std::string& dest, const char *data, size_t len);
+
+#endif
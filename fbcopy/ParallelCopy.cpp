@@ -0,0 +1,339 @@
+/*
+
+Copyright (c) 2005-2007 Milan Babuskov
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Option W: tables of S operation are copied by several workers, each with
+// its own connections to both databases. A table is handed out when all
+// tables it depends on (foreign keys, check constraints) are copied, and of
+// the tables that are ready the biggest goes first. All workers read the
+// source at the same point, so rows of a child table always have their
+// parents copied.
+
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "args.h"
+#include "fbcopy.h"
+
+struct CopyTask
+{
+    std::string table;
+    int64_t pages;              // pointer pages, grows with size of table
+    double rows;                // estimated from unique index statistics
+    int waiting;                // tables that have to be copied first
+    std::vector<int> dependents;
+};
+
+struct CopyPool
+{
+    std::vector<CopyTask> tasks;
+    std::vector<int> ready;     // heap, biggest table on top
+    size_t done;
+    bool failed;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::mutex bulkLock;        // BulkLoad uses main connection
+};
+
+// order of ready heap
+struct SmallerTable
+{
+    const std::vector<CopyTask> *tasks;
+    bool operator()(int a, int b) const
+    {
+        const CopyTask& ta = (*tasks)[a];
+        const CopyTask& tb = (*tasks)[b];
+        if (ta.pages != tb.pages)
+            return ta.pages < tb.pages;
+        return ta.rows < tb.rows;
+    }
+};
+
+void FBCopy::copyParallel(const std::vector<std::string>& order)
+{
+    CopyPool pool;
+    pool.done = 0;
+    pool.failed = false;
+    std::map<std::string, int> index;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        CopyTask t;
+        t.table = order[i];
+        t.pages = 0;
+        t.rows = 0;
+        t.waiting = 0;
+        pool.tasks.push_back(t);
+        index[order[i]] = (int)i;
+    }
+
+    // Tree only keeps first dependency on each table, so they are loaded
+    // again. Only tables that come earlier in order are waited for, which
+    // breaks cycles the same way as copying one by one does
+    IBPP::Statement *deps[] = { &stDepsFK, &stDepsCheck };
+    for (size_t i = 0; i < pool.tasks.size(); i++)
+    {
+        for (int d = 0; d < 2; d++)
+        {
+            IBPP::Statement& st = *deps[d];
+            st->Set(1, pool.tasks[i].table);
+            st->Execute();
+            while (st->Fetch())
+            {
+                std::string s;
+                st->Get(1, s);
+                s.erase(s.find_last_not_of(" ") + 1);
+                std::map<std::string, int>::iterator it = index.find(s);
+                if (it == index.end() || it->second >= (int)i)
+                    continue;
+                std::vector<int>& after = pool.tasks[it->second].dependents;
+                if (std::find(after.begin(), after.end(), (int)i) == after.end())
+                {
+                    after.push_back((int)i);
+                    pool.tasks[i].waiting++;
+                }
+            }
+        }
+    }
+
+    IBPP::Statement st = IBPP::StatementFactory(src, transDep);
+    st->Prepare(
+        "select r.rdb$relation_name, count(p.rdb$page_number) from rdb$relations r "
+        "join rdb$pages p on p.rdb$relation_id = r.rdb$relation_id and p.rdb$page_type = 4 "
+        "group by 1"
+    );
+    st->Execute();
+    while (st->Fetch())
+    {
+        std::string s;
+        st->Get(1, s);
+        s.erase(s.find_last_not_of(" ") + 1);
+        std::map<std::string, int>::iterator it = index.find(s);
+        if (it != index.end())
+            st->Get(2, pool.tasks[it->second].pages);
+    }
+    st->Prepare(
+        "select rdb$relation_name, max(1 / rdb$statistics) from rdb$indices "
+        "where rdb$unique_flag = 1 and rdb$statistics > 0 group by 1"
+    );
+    st->Execute();
+    while (st->Fetch())
+    {
+        std::string s;
+        st->Get(1, s);
+        s.erase(s.find_last_not_of(" ") + 1);
+        std::map<std::string, int>::iterator it = index.find(s);
+        if (it != index.end())
+            st->Get(2, pool.tasks[it->second].rows);
+    }
+
+    SmallerTable smaller = { &pool.tasks };
+    for (size_t i = 0; i < pool.tasks.size(); i++)
+        if (pool.tasks[i].waiting == 0)
+            pool.ready.push_back((int)i);
+    std::make_heap(pool.ready.begin(), pool.ready.end(), smaller);
+
+    int workers = ar->Workers;
+    if (workers > (int)pool.tasks.size())
+        workers = (int)pool.tasks.size();
+    std::vector<FBCopy> crew(workers);
+    if (!startWorkers(crew, order))
+        throw std::runtime_error("Cannot start workers.");
+    fprintf(stderr, "Copying %d tables with %d workers...\n", (int)pool.tasks.size(), workers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+        threads.push_back(std::thread(&FBCopy::copyWorker, this, &pool, &crew[i]));
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    if (pool.failed)
+        throw std::runtime_error("Copying of tables stopped.");
+}
+
+// Connects all workers and starts their source transactions, so they see
+// the same data. On Firebird 4 and up they share the snapshot of a
+// transaction started here, with older servers copied tables are reserved
+// (no one can write to them) while workers are starting
+bool FBCopy::startWorkers(std::vector<FBCopy>& crew, const std::vector<std::string>& tables)
+{
+    for (size_t i = 0; i < crew.size(); i++)
+    {
+        FBCopy& w = crew[i];
+        w.ar = ar;
+        w.bulk = 0;
+        w.sharedSource = true;
+        if (!w.connect(w.src, ar->Src) || !w.connect(w.dest, ar->Dest))
+            return false;
+    }
+
+    try
+    {
+        IBPP::Transaction tr = IBPP::TransactionFactory(src, IBPP::amRead);
+        tr->Start();
+        for (size_t i = 0; i < crew.size(); i++)
+        {
+            crew[i].trans1 = IBPP::TransactionFactory(crew[i].src, IBPP::amRead);
+            crew[i].trans2 = IBPP::TransactionFactory(crew[i].dest, IBPP::amWrite);
+        }
+
+        int64_t snapshot = 0;
+        try
+        {
+            snapshot = tr->SnapshotNumber();
+        }
+        catch (IBPP::Exception &)   // client library too old
+        {
+        }
+
+        IBPP::Transaction guard;
+        if (snapshot)
+        {
+            fprintf(stderr, "Workers share snapshot number %lld.\n", (long long)snapshot);
+            for (size_t i = 0; i < crew.size(); i++)
+                crew[i].trans1->AtSnapshotNumber(crew[i].src, snapshot);
+        }
+        else
+        {
+            fprintf(stderr, "Locking tables for consistent start of workers...");
+            guard = IBPP::TransactionFactory(src, IBPP::amRead);
+            for (size_t i = 0; i < tables.size(); i++)
+                guard->AddReservation(src, tables[i], IBPP::trProtectedRead);
+            guard->Start();     // waits for pending writers
+            fprintf(stderr, "Done.\n");
+        }
+
+        for (size_t i = 0; i < crew.size(); i++)
+            crew[i].trans1->Start();
+        if (guard.intf())
+            guard->Commit();
+        tr->Commit();
+    }
+    catch (IBPP::Exception &e)
+    {
+        fprintf(stderr, "ERROR!\n%s", e.ErrorMessage());
+        return false;
+    }
+    return true;
+}
+
+void FBCopy::copyWorker(CopyPool *pool, FBCopy *worker)
+{
+    FBCopy& w = *worker;
+    IBPP::Transaction tr1, tr2;
+    IBPP::Statement st1, st2;
+    bool ok = true;
+    try
+    {
+        tr1 = IBPP::TransactionFactory(w.src, IBPP::amRead);
+        tr2 = IBPP::TransactionFactory(w.dest, IBPP::amRead);
+        tr1->Start();
+        tr2->Start();
+        st1 = IBPP::StatementFactory(w.src, tr1);
+        st2 = IBPP::StatementFactory(w.dest, tr2);
+        w.prepareFieldList(st1);
+        w.prepareFieldList(st2);
+    }
+    catch (IBPP::Exception &e)
+    {
+        fprintf(stderr, "ERROR!\n%s", e.ErrorMessage());
+        ok = false;
+    }
+    if (!ok)
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->failed = true;
+        pool->changed.notify_all();
+        return;
+    }
+
+    SmallerTable smaller = { &pool->tasks };
+    while (true)
+    {
+        int t;
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            while (pool->ready.empty() && !pool->failed && pool->done < pool->tasks.size())
+                pool->changed.wait(guard);
+            if (pool->ready.empty() || pool->failed)
+                break;
+            std::pop_heap(pool->ready.begin(), pool->ready.end(), smaller);
+            t = pool->ready.back();
+            pool->ready.pop_back();
+        }
+
+        const std::string& table = pool->tasks[t].table;
+        try
+        {
+            {
+                std::lock_guard<std::mutex> guard(pool->bulkLock);
+                disableIndexes(table);
+            }
+            w.compareTable(table, st1, st2, tr1);
+        }
+        catch (IBPP::Exception &e)
+        {
+            fprintf(stderr, "ERROR copying table %s!\n%s", table.c_str(), e.ErrorMessage());
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool->failed = true;
+            pool->changed.notify_all();
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->done++;
+        std::vector<int>& after = pool->tasks[t].dependents;
+        for (size_t i = 0; i < after.size(); i++)
+        {
+            if (--pool->tasks[after[i]].waiting == 0)
+            {
+                pool->ready.push_back(after[i]);
+                std::push_heap(pool->ready.begin(), pool->ready.end(), smaller);
+            }
+        }
+        pool->changed.notify_all();
+    }
+
+    try
+    {
+        tr1->Commit();
+        tr2->Commit();
+        w.trans1->Commit();
+    }
+    catch (IBPP::Exception&)
+    {
+    }
+}
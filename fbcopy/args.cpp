@@ -34,6 +34,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //---------------------------------------------------------------------------
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
 #pragma hdrstop
 #include "args.h"
 Args::Args(int argc, char **argv)
@@ -56,6 +57,8 @@ Args::Args(int argc, char **argv)
     NotNulls = true;
     Html = false;
     Limited = false;
+    Bulk = false;
+    Workers = 1;
     Verbose = false;
     Update = false;
     Error = "OK";       // initial values (local)
@@ -81,6 +84,13 @@ Args::Args(int argc, char **argv)
             case 'V':   Verbose = true;             break;
             case 'U':   Update  = true;             break;
             case 'L':   Limited = true;             break;
+            case 'B':   Bulk = true;                break;
+            case 'W':   Workers = 0;                // W4 = four workers
+                while (argv[1][i+1] >= '0' && argv[1][i+1] <= '9')
+                    Workers = Workers * 10 + (argv[1][++i] - '0');
+                if (Workers == 0)
+                    Workers = std::thread::hardware_concurrency();
+                break;
             case '1':   case '2':    case '3':  case '4':
                 DisplayDifferences |= (1 << (c-'1'));
                 break;
@@ -103,6 +113,13 @@ Args::Args(int argc, char **argv)
         Error = "Option H is only available with D, A or X";
     if (Update && Operation != opCopy)
         Error = "Option U is only avaliable with C";
+    if (Bulk && Operation != opCopy && Operation != opSingle)
+        Error = "Option B is only available with C or S";
+    if (Workers > 1 && Operation != opSingle)
+        Error = "Option W is only available with S";
+    // destination rows of a worker would not be seen by FK checks of others
+    if (Workers > 1 && SingleTransaction)
+        Error = "Option W cannot be used with E";
 }
 void Args::createDBInfo(DatabaseInfo& db, char *string)
 {
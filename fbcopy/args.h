@@ -78,6 +78,8 @@ public:
     bool Verbose;
     bool Update;
     bool Limited;
+    bool Bulk;          // deactivate indexes of destination tables while copying
+    int Workers;        // tables copied at once by S, each over own connections
     int DisplayDifferences;
     tOperation Operation;
 
@@ -44,12 +44,16 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <string.h>
 
 #include <string>
 #include <sstream>
 #include <list>
 #include <algorithm>
+#include <stdexcept>
 
+#include "Formatting.h"
+#include "TextKernels.h"
 #include "args.h"
 #include "fbcopy.h"
 
@@ -68,7 +72,7 @@ int FBCopy::Run(Args *a)
                     (IBPP::Version >> 8) % 256,
                     IBPP::Version % 256);
         fprintf(stderr, "A command-line tool to copy and compare data in Firebird databases.\n\n");
-        fprintf(stderr, "Usage: fbcopy {D|C|A|S|X}[UEKNFVH1234] {source} {destination}\n\n");
+        fprintf(stderr, "Usage: fbcopy {D|C|A|S|X}[UEKNFBWVH1234] {source} {destination}\n\n");
 
         fprintf(stderr, "Source and destination format is [user:password@][host:]database[?charset]\n\n");
 
@@ -85,6 +89,10 @@ int FBCopy::Run(Args *a)
         fprintf(stderr, "K  Keep going (default = stop on first record that cannot be copied)\n");
         fprintf(stderr, "V  Verbose, show all errors with K option (default = off)\n");
         fprintf(stderr, "F  Fire triggers (default = temporary deactivate triggers)\n");
+        fprintf(stderr, "B  Bulk - deactivate indexes of copied tables, rebuild them at the end.\n");
+        fprintf(stderr, "   Journal %s is kept to recover if fbcopy dies\n", BULK_JOURNAL_DEFAULT);
+        fprintf(stderr, "W  Workers - used with S. W4 copies up to 4 tables at once, each over its\n");
+        fprintf(stderr, "   own connections (W alone = number of CPUs)\n");
         fprintf(stderr, "N  Nulls - used with A. Doesn't put NOT NULL in ALTER TABLE statements\n");
         fprintf(stderr, "H  Html  - used with D, A, X. Outputs differences in HTML format\n");
         fprintf(stderr, "L  Limited - if table doesn't have row to display - don't show the table\n");
@@ -98,6 +106,18 @@ int FBCopy::Run(Args *a)
     if (!connect(src, ar->Src) || !connect(dest, ar->Dest))
         return 2;
 
+    bulk = 0;
+    sharedSource = false;
+    if (ar->Bulk)
+    {
+        bulk = new BulkLoad(dest, BULK_JOURNAL_DEFAULT);
+        if (!bulk->Recover())   // left by earlier run that died
+        {
+            delete bulk;
+            return 5;
+        }
+    }
+
     int retval = 0;
     try
     {
@@ -129,12 +149,23 @@ int FBCopy::Run(Args *a)
         fprintf(stderr, "%s", e.ErrorMessage());
         retval = 3;
     }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "ERROR!\n%s\n", e.what());
+        retval = 4;
+    }
     catch (...)
     {
         fprintf(stderr, "ERROR!\nA non-IBPP C++ runtime exception occured !\n\n");
         retval = 4;
     }
     enableTriggers();
+    if (bulk)       // indexes, and triggers with it
+    {
+        if (!bulk->Restore() && retval == 0)
+            retval = 5;
+        delete bulk;
+    }
     return retval;
 }
 
@@ -143,6 +174,13 @@ void FBCopy::disableTriggers()
     if (ar->FireTriggers || ar->Operation != opCopy && ar->Operation != opSingle)
         return;
 
+    if (bulk)       // written to journal, activated by bulk->Restore()
+    {
+        if (!bulk->DisableTriggers(""))
+            throw std::runtime_error("Triggers could not be deactivated.");
+        return;
+    }
+
     fprintf(stderr, "Disabling triggers...");
     IBPP::Transaction tr1 = IBPP::TransactionFactory(dest);
     tr1->Start();
@@ -208,6 +246,18 @@ void FBCopy::enableTriggers()
     }
 }
 
+// option B: indexes are deactivated before the first row of table is copied
+void FBCopy::disableIndexes(const std::string& table)
+{
+    if (!bulk)
+        return;
+    std::string name(table);
+    if (name.length() > 1 && name[0] == '"')    // as stored in system tables
+        name = name.substr(1, name.length() - 2);
+    if (!bulk->DisableIndexes(name))
+        fprintf(stderr, "Copying %s with indexes active.\n", table.c_str());
+}
+
 std::vector<std::string> FBCopy::explode(const std::string& sep, const std::string& ins)
 {
     std::vector<std::string> v;
@@ -355,7 +405,8 @@ void FBCopy::setupFromStdin(CompareOrCopy action)
             std::set<std::string> pkcols;
             std::string update = getUpdateStatement(table, fields, pkcols);
             printf("Copying table: %s\n", table.c_str());
-            copy(select, insert, update, pkcols);
+            disableIndexes(table);
+            copy(table, select, insert, update, pkcols);
         }
         else    // compare records
         {
@@ -439,14 +490,8 @@ std::string nl2br(const std::string &input)
     return s;
 }
 
-void scaleInt(std::string& s, unsigned int scale)
-{
-    if (scale == 0)
-        return;
-    while (s.length() <= scale)
-        s = "0" + s;
-    s.insert(s.length() - scale, ".");
-}
+// dates and times in HTML output, non-breaking so they stay on one line
+static const DateTimeFormat htmlFormat("Y&#x2011;M&#x2011;D", "H:M:S", "&nbsp;");
 
 string createHumanString(IBPP::Statement& st, int col, bool& numeric)
 {
@@ -455,75 +500,58 @@ string createHumanString(IBPP::Statement& st, int col, bool& numeric)
     if (st->IsNull(col))
         return "NULL";
 
-    char *c;                // temporary variables, declared here since declaring
-    char str[30];           // inside "switch" isn't possible
-    double dval;
-    float fval;
+    double dval;            // temporary variables, declared here since declaring
+    float fval;             // inside "switch" isn't possible
     int64_t int64val;
     int x;
     IBPP::Date d;
     IBPP::Time t;
     IBPP::Timestamp ts;
-    int year, month, day, hour, minute, second, millisec;
+    const char *data;
+    int len;
 
     IBPP::SDT DataType = st->ColumnType(col);
     //if (DataType == IBPP::sdDate && Dialect == 1)
     //    DataType = IBPP::sdTimestamp;
 
-    value = "";
     switch (DataType)
     {
         case IBPP::sdString:
-            st->Get(col, value);
-            value.erase(value.find_last_not_of(' ')+1);
+            st->GetString(col, data, len, false);
+            appendHtml(value, data, trimmedLength(data, len));
             break;
         case IBPP::sdInteger:
         case IBPP::sdSmallint:
             st->Get(col, &x);
-            sprintf(str, "%ld", x);
-            value = str;
+            appendScaled(value, x, st->ColumnScale(col));
             numeric = true;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
             break;
         case IBPP::sdDate:
             st->Get(col, d);
-            if (IBPP::dtoi(d.GetDate(), &year, &month, &day))
-            {
-                sprintf(str, "%04d&#x2011;%02d&#x2011;%02d", year, month, day);
-                value = str;
-            }
+            htmlFormat.AppendDate(value, d.GetDate());
             break;
         case IBPP::sdTime:
             st->Get(col, t);
-            IBPP::ttoi(t.GetTime(), &hour, &minute, &second, &millisec);
-            sprintf(str, "%02d:%02d:%02d", hour, minute, second);
-            value = str;
+            htmlFormat.AppendTime(value, t.GetTime());
             break;
         case IBPP::sdTimestamp:
             st->Get(col, ts);
-            IBPP::ttoi(ts.GetTime(), &hour, &minute, &second, &millisec);
-            IBPP::dtoi(ts.GetDate(), &year, &month, &day);
-            sprintf(str, "%04d&#x2011;%02d&#x2011;%02d&nbsp;%02d:%02d:%02d", year, month, day, hour, minute, second);
-            value = str;
+            htmlFormat.AppendTimestamp(value, ts.GetDate(), ts.GetTime());
             break;
         case IBPP::sdFloat:
-            st->Get(col, &fval);            
-            snprintf(str,30,"%19g",fval);
-            value = str;
+            st->Get(col, &fval);
+            appendFloat(value, fval);
             numeric = true;
             break;
         case IBPP::sdDouble:
             st->Get(col, &dval);
-            snprintf(str,30,"%19g",dval);
-            value = str;
+            appendDouble(value, dval);
             numeric = true;
             break;
         case IBPP::sdLargeint:
             st->Get(col, &int64val);
-            sprintf(str, INT64FORMAT, int64val);
-            value = str;
+            appendScaled(value, int64val, st->ColumnScale(col));
             numeric = true;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
             break;
 
         default:
@@ -883,14 +911,8 @@ void FBCopy::compare()
     IBPP::Transaction tr2 = IBPP::TransactionFactory(dest, IBPP::amRead);
     tr2->Start();
     IBPP::Statement st2 = IBPP::StatementFactory(dest, tr2);
-    std::string sql =
-        " SELECT r.rdb$field_name FROM rdb$relation_fields r"
-        " JOIN rdb$fields f ON r.rdb$field_source = f.rdb$field_name"
-        " WHERE r.rdb$relation_name = ? "
-        " AND f.rdb$computed_blr is null"
-        " ORDER BY 1";
-    st1->Prepare(sql);
-    st2->Prepare(sql);
+    prepareFieldList(st1);
+    prepareFieldList(st2);
 
     if (ar->Html)   // html header
     {
@@ -913,7 +935,14 @@ void FBCopy::compare()
         }
     }
 
-    preOrder(&tree, st1, st2, tr1);
+    if (ar->Operation == opSingle && ar->Workers > 1)
+    {
+        std::vector<std::string> order;
+        listTables(&tree, order);
+        copyParallel(order);
+    }
+    else
+        preOrder(&tree, st1, st2, tr1);
     int generators = compareGenerators(tr1, tr2);
 
     if (ar->Html)
@@ -1041,12 +1070,13 @@ int FBCopy::getPkIndex(IBPP::Statement& st1, int i, std::set<std::string>&pkcols
     return -1;
 }
 
-bool FBCopy::copy(const std::string& select, const std::string& insert,
+bool FBCopy::copy(const std::string& table, const std::string& select, const std::string& insert,
     const std::string& update, std::set<std::string>& pkcols)
 {
     if (!ar->SingleTransaction)
     {
-        trans1->Start();
+        if (!sharedSource)
+            trans1->Start();
         trans2->Start();
     }
     IBPP::Statement st1 = IBPP::StatementFactory(src, trans1);
@@ -1070,6 +1100,19 @@ bool FBCopy::copy(const std::string& select, const std::string& insert,
 
     int columns = st1->Columns();
 
+    // columns stored the same way in both databases are copied as they are
+    std::vector<bool> raw2(columns + 1), raw3(columns + 1), rawPk(columns + 1);
+    for (int i=1; i<=columns; ++i)
+    {
+        raw2[i] = sameNativeType(st1, i, st2, i);
+        if (ar->Update)
+        {
+            raw3[i] = sameNativeType(st1, i, st3, i);
+            int pkx = getPkIndex(st1, i, pkcols);
+            rawPk[i] = (pkx > -1 && sameNativeType(st1, i, st3, pkx));
+        }
+    }
+
     int cnt = 0;
     int errors = 0;
     int partial = 0;
@@ -1091,10 +1134,10 @@ bool FBCopy::copy(const std::string& select, const std::string& insert,
                 }
                 continue;
             }
-            int ok = copyData(st1, st2, i, i) ? 0 : 1;
+            int ok = copyData(st1, st2, i, i, raw2[i]) ? 0 : 1;
             if (ok == 0 && ar->Update)
-                ok = copyData(st1, st3, i, i) ? 0 : 2;
-            if (ok == 0 && pkx > -1 && !copyData(st1, st3, i, pkx))
+                ok = copyData(st1, st3, i, i, raw3[i]) ? 0 : 2;
+            if (ok == 0 && pkx > -1 && !copyData(st1, st3, i, pkx, rawPk[i]))
             {
                 fprintf(stderr, "Error copying column number: %d, name: %s to primary key parameter: %d\n",
                     i, st1->ColumnName(i), pkx);
@@ -1162,18 +1205,23 @@ bool FBCopy::copy(const std::string& select, const std::string& insert,
         if (++cnt % 2000 == 0)
             fprintf(stderr, "Checkpoint at %d rows.\n", cnt);
     }
-    printf("%d records copied", cnt - errors);
+    // printed at once, as other tables might be copied at the same time (W)
+    std::stringstream msg;
+    if (ar->Workers > 1)
+        msg << table << ": ";
+    msg << (cnt - errors) << " records copied";
     if (partial > 0)
-        printf(" (%d only partially)", partial);
+        msg << " (" << partial << " only partially)";
     if (!ar->SingleTransaction)
     {
-        trans1->Commit();
+        if (!sharedSource)
+            trans1->Commit();
         trans2->Commit();
-        printf(" and commited");
+        msg << " and commited";
     }
     if (errors)
-        printf(". Failed to copy %d records", errors);
-    printf(".\n");
+        msg << ". Failed to copy " << errors << " records";
+    printf("%s.\n", msg.str().c_str());
     return true;
 }
 
@@ -1188,6 +1236,15 @@ int cmpval(const T& one, const T& two)
         return 1;
 }
 
+// compares strings the same way std::string does, without copying them
+int cmpText(const char *one, int len1, const char *two, int len2)
+{
+    int res = memcmp(one, two, len1 < len2 ? len1 : len2);
+    if (res == 0)
+        res = len1 - len2;
+    return (res < 0 ? -1 : (res > 0 ? 1 : 0));
+}
+
 // returns zero if same, -1 if src<dest and +1 if src>dest
 int FBCopy::cmpData(IBPP::Statement& st1, IBPP::Statement& st2, int col)
 {
@@ -1198,7 +1255,8 @@ int FBCopy::cmpData(IBPP::Statement& st1, IBPP::Statement& st2, int col)
     if (!st1->IsNull(col) && st2->IsNull(col))
         return -1;
 
-    string s, s2;       // temporary variables, declared here since declaring
+    const char *s, *s2; // temporary variables, declared here since declaring
+    int len, len2;      // inside "switch" isn't possible
     double dval, dval2;
     float fval, fval2;
     short sh, sh2;
@@ -1218,9 +1276,9 @@ int FBCopy::cmpData(IBPP::Statement& st1, IBPP::Statement& st2, int col)
     switch (DataType)
     {
         case IBPP::sdString:
-            st1->Get(col, s);
-            st2->Get(col, s2);
-            return cmpval(s, s2);
+            st1->GetString(col, s, len, false);
+            st2->GetString(col, s2, len2, false);
+            return cmpText(s, len, s2, len2);
         case IBPP::sdSmallint:
             st1->Get(col, sh);
             st2->Get(col, sh2);
@@ -1263,11 +1321,25 @@ int FBCopy::cmpData(IBPP::Statement& st1, IBPP::Statement& st2, int col)
     };
 }
 
-bool FBCopy::copyData(IBPP::Statement& st1, IBPP::Statement& st2, int srccol,
+// true if column srccol and parameter destcol have the same type, size and
+// scale, so the value can be copied in its native form. Strings are copied
+// without conversion anyway, blobs need to be read
+bool FBCopy::sameNativeType(IBPP::Statement& st1, int srccol, IBPP::Statement& st2,
     int destcol)
 {
-    string s;       // temporary variables, declared here since declaring
-    char str[30];   // inside "switch" isn't possible
+    IBPP::SDT type = st1->ColumnType(srccol);
+    return (type != IBPP::sdBlob && type != IBPP::sdArray && type != IBPP::sdString
+        && type == st2->ParameterType(destcol)
+        && st1->ColumnSize(srccol) == st2->ParameterSize(destcol)
+        && st1->ColumnScale(srccol) == st2->ParameterScale(destcol));
+}
+
+// raw = value can be copied in native form, see sameNativeType()
+bool FBCopy::copyData(IBPP::Statement& st1, IBPP::Statement& st2, int srccol,
+    int destcol, bool raw)
+{
+    const char *s;  // temporary variables, declared here since declaring
+    int len;        // inside "switch" isn't possible
     double dval;
     float fval;
     short sh;
@@ -1288,11 +1360,22 @@ bool FBCopy::copyData(IBPP::Statement& st1, IBPP::Statement& st2, int srccol,
 
     try
     {
+        if (raw)
+        {
+            const void *data;
+            st1->GetRaw(srccol, data, len);
+            st2->SetRaw(destcol, data, len);
+            return true;
+        }
+
         switch (DataType)
         {
-            case IBPP::sdString:
-                st1->Get(srccol, s);
-                st2->Set(destcol, s);
+            case IBPP::sdString:    // copied straight from one row to another
+                st1->GetString(srccol, s, len, false);
+                if (st2->ParameterType(destcol) == IBPP::sdString)
+                    st2->Set(destcol, s, len);
+                else
+                    st2->Set(destcol, string(s, len));
                 return true;
             case IBPP::sdSmallint:
                 st1->Get(srccol, sh);
@@ -1508,6 +1591,28 @@ void FBCopy::preOrder(TableDependency* a, IBPP::Statement& st1, IBPP::Statement&
         compareTable(a->tableName, st1, st2, tr1);
 }
 
+// same order as preOrder()
+void FBCopy::listTables(TableDependency* a, std::vector<std::string>& order)
+{
+    for (std::list<TableDependency *>::iterator tmp = a->dependencies.begin(); tmp != a->dependencies.end(); ++tmp)
+        listTables(*tmp, order);
+
+    if (a->tableName != "root")
+        order.push_back(a->tableName);
+}
+
+// columns of table, used by compareTable()
+void FBCopy::prepareFieldList(IBPP::Statement& st)
+{
+    st->Prepare(
+        " SELECT r.rdb$field_name FROM rdb$relation_fields r"
+        " JOIN rdb$fields f ON r.rdb$field_source = f.rdb$field_name"
+        " WHERE r.rdb$relation_name = ? "
+        " AND f.rdb$computed_blr is null"
+        " ORDER BY 1"
+    );
+}
+
 // moved from old compare function
 
 void FBCopy::compareTable(std::string table, IBPP::Statement& st1, IBPP::Statement& st2, IBPP::Transaction& tr1)
@@ -1643,8 +1748,9 @@ void FBCopy::compareTable(std::string table, IBPP::Statement& st1, IBPP::Stateme
                 + ") VALUES (" + params(join(fields,"",",")) + ")";
             //std::string update = getUpdateStatement(table, fields, pkcols)
             printf("Copying table: %s\n", table.c_str());
+            disableIndexes(table);
             std::set<std::string> dummy;
-            copy(select, insert, "", dummy);
+            copy(table, select, insert, "", dummy);
         }
     }
 }
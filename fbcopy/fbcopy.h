@@ -33,14 +33,18 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <string>
 #include <sstream>
 #include "TableDependency.h"
+#include "BulkLoad.h"
 #include "args.h"
 #include "ibpp.h"
 
+struct CopyPool;
 
 class FBCopy
 {
 private:
     std::vector<std::string> triggers;
+    BulkLoad *bulk;         // option B, or 0
+    bool sharedSource;      // trans1 is kept for all tables (W), see ParallelCopy.cpp
     IBPP::Database src, dest;
     IBPP::Statement stDepsFK, stDepsCheck;
     IBPP::Transaction trans1, trans2, transDep;
@@ -49,13 +53,21 @@ private:
 
     void disableTriggers();
     void enableTriggers();
+    void disableIndexes(const std::string& table);
     bool connect(IBPP::Database& db1, DatabaseInfo d);
-    bool copy(const std::string& select, const std::string& insert,
+    bool copy(const std::string& table, const std::string& select, const std::string& insert,
         const std::string& update, std::set<std::string>& pkcols);
     void addDeps(std::list<std::string>& deps, const std::string& table, IBPP::Statement& st);
     void getDependencies(TableDependency* dep, std::string ntable);
     void setDependencies(std::list<std::string> tableList);
     void preOrder(TableDependency* a, IBPP::Statement& st1, IBPP::Statement& st2, IBPP::Transaction& tr1);
+    void listTables(TableDependency* a, std::vector<std::string>& order);
+    void prepareFieldList(IBPP::Statement& st);
+
+    // option W, see ParallelCopy.cpp
+    void copyParallel(const std::vector<std::string>& order);
+    bool startWorkers(std::vector<FBCopy>& crew, const std::vector<std::string>& tables);
+    void copyWorker(CopyPool *pool, FBCopy *worker);
     void compareTable(std::string table, IBPP::Statement& st1, IBPP::Statement& st2, IBPP::Transaction& tr1);
     int  compareGenerators(IBPP::Transaction tr1, IBPP::Transaction tr2);
     void compareGeneratorValues(const std::string& gfrom, const std::string& gto);
@@ -77,7 +89,9 @@ private:
     std::string join(const std::set<std::string>& s, const std::string& qualifier, const std::string& glue);
     std::vector<std::string> explode(const std::string& sep, const std::string& ins);
     std::string params(const std::string& fieldlist);
-    bool copyData(IBPP::Statement& st1, IBPP::Statement& st2, int srccol, int destcol);
+    bool sameNativeType(IBPP::Statement& st1, int srccol, IBPP::Statement& st2, int destcol);
+    bool copyData(IBPP::Statement& st1, IBPP::Statement& st2, int srccol, int destcol,
+        bool raw = false);
     bool copyBlob(IBPP::Statement& st1, IBPP::Statement& st2, int col);
     std::string getDatatype(IBPP::Statement& st1, std::string table, std::string fieldname, bool not_nulls = true);
 
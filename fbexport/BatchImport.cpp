@@ -0,0 +1,344 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : BatchImport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Import of many rows at once. Rows are queued into
+//                parameters of EXECUTE BLOCK which repeats import statement
+//                for each of them, so there is one server round trip per block
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+#define BATCH_MAX_MESSAGE 65535     // bytes of input parameters of statement
+
+// Type of block's parameter which takes value of parameter i of import
+// statement. Character sets of strings are looked up once and kept in
+// charsets. Returns false if type cannot be declared
+bool FBExport::DeclareParameter(IBPP::Statement& st, int i,
+    map<int, pair<string, int> >& charsets, string& decl)
+{
+    int scale = st->ParameterScale(i);
+    string num;
+    switch (st->ParameterType(i))
+    {
+        case IBPP::sdString:
+        {
+            int id = (st->ParameterSubtype(i) & 0xFF);
+            map<int, pair<string, int> >::iterator it = charsets.find(id);
+            if (it == charsets.end())
+            {
+                IBPP::Statement meta = IBPP::StatementFactory(st->DatabasePtr(),
+                    st->TransactionPtr());
+                meta->Prepare("select rdb$character_set_name, rdb$bytes_per_character "
+                    "from rdb$character_sets where rdb$character_set_id = ?");
+                meta->Set(1, id);
+                meta->Execute();
+                if (!meta->Fetch())
+                    return false;
+                string name;
+                int bytes;
+                meta->Get(1, name);
+                meta->Get(2, bytes);
+                name.erase(name.find_last_not_of(' ')+1);   // trim
+                if (bytes < 1)
+                    bytes = 1;
+                it = charsets.insert(make_pair(id, make_pair(name, bytes))).first;
+            }
+            int length = st->ParameterSize(i) / it->second.second;
+            if (length < 1)
+                length = 1;
+            decl = "VARCHAR(";
+            appendInt(decl, length);
+            decl += ") CHARACTER SET " + it->second.first;
+            return true;
+        }
+        case IBPP::sdSmallint:  decl = "SMALLINT";  num = "NUMERIC(4,";   break;
+        case IBPP::sdInteger:   decl = "INTEGER";   num = "NUMERIC(9,";   break;
+        case IBPP::sdLargeint:  decl = "BIGINT";    num = "NUMERIC(18,";  break;
+        case IBPP::sdFloat:     decl = "FLOAT";                 return true;
+        case IBPP::sdDouble:    decl = "DOUBLE PRECISION";      return true;
+        case IBPP::sdDate:      decl = "DATE";                  return true;
+        case IBPP::sdTime:      decl = "TIME";                  return true;
+        case IBPP::sdTimestamp: decl = "TIMESTAMP";             return true;
+        case IBPP::sdBlob:
+            decl = "BLOB SUB_TYPE ";
+            appendInt(decl, st->ParameterSubtype(i));
+            return true;
+        default:
+            return false;
+    }
+    if (scale)      // scaled integers
+    {
+        decl = num;
+        appendInt(decl, scale < 0 ? -scale : scale);
+        decl += ")";
+    }
+    return true;
+}
+
+// EXECUTE BLOCK which runs import statement for given number of rows. Row r
+// gets parameters Pr_1 .. Pr_n of block
+string FBExport::BlockSQL(ImportBatch *batch, int rows)
+{
+    // statement without trailing semicolon
+    string sql(ar->SQL);
+    sql.erase(sql.find_last_not_of(" \t\r\n;")+1);
+
+    string result = "EXECUTE BLOCK (";
+    for (int r = 1; r <= rows; r++)
+    {
+        for (int j = 1; j <= batch->params; j++)
+        {
+            if (r > 1 || j > 1)
+                result += ", ";
+            result += "P";
+            appendInt(result, r);
+            result += "_";
+            appendInt(result, j);
+            result += " " + batch->declarations[j-1] + " = ?";
+        }
+    }
+    result += ")\nAS BEGIN\n";
+
+    for (int r = 1; r <= rows; r++)
+    {
+        result += "  ";
+        char quote = 0;
+        int j = 0;
+        for (string::size_type i = 0; i < sql.length(); i++)
+        {
+            char c = sql[i];
+            if (quote)              // question marks in literals are not parameters
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '\'' || c == '"')
+                quote = c;
+            else if (c == '?')
+            {
+                result += ":P";
+                appendInt(result, r);
+                result += "_";
+                appendInt(result, ++j);
+                continue;
+            }
+            result += c;
+        }
+        result += ";\n";
+    }
+    result += "END";
+    return result;
+}
+
+// Prepares EXECUTE BLOCK for as many rows as allowed by ar->Batch and by
+// server's limits. Returns 0 if rows should be imported one by one
+ImportBatch *FBExport::PrepareBatch(IBPP::Statement& st)
+{
+    int params = st->Parameters();
+    IBPP::STT type = st->Type();
+    // output columns (RETURNING, or values returned by procedure) would be
+    // lost inside of the block
+    if (params == 0 || Dialect < 3 || st->Columns() > 0 || (type != IBPP::stInsert
+        && type != IBPP::stUpdate && type != IBPP::stDelete
+        && type != IBPP::stExecProcedure))
+    {
+        Printf("Statement cannot be batched, importing row by row.\n");
+        return 0;
+    }
+
+    ImportBatch *batch = new ImportBatch;
+    batch->params = params;
+    batch->rows = 0;
+    int rowBytes = 0;       // size of row's parameters in message
+    map<int, pair<string, int> > charsets;
+    try
+    {
+        for (int i=1; i<=params; i++)
+        {
+            string decl;
+            if (!DeclareParameter(st, i, charsets, decl))
+            {
+                Printf("Parameter %d cannot be batched, importing row by row.\n", i);
+                delete batch;
+                return 0;
+            }
+            batch->declarations.push_back(decl);
+            rowBytes += (st->ParameterSize(i) + 4 + 7) & ~7;   // data, null flag, alignment
+        }
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+        delete batch;
+        return 0;
+    }
+
+    int rows = ar->Batch;
+    if (rows > BATCH_MAX_ROWS)
+        rows = BATCH_MAX_ROWS;
+    if (rows > BATCH_MAX_MESSAGE / rowBytes)
+        rows = BATCH_MAX_MESSAGE / rowBytes;
+    string sql;
+    while (rows > 1)
+    {
+        sql = BlockSQL(batch, rows);
+        if (sql.length() > BATCH_MAX_SQL)
+        {
+            rows = rows * BATCH_MAX_SQL / sql.length();
+            continue;
+        }
+        try
+        {
+            batch->block = IBPP::StatementFactory(st->DatabasePtr(), st->TransactionPtr());
+            batch->block->Prepare(sql);
+            break;
+        }
+        catch (IBPP::Exception &)   // i.e. too many contexts, try smaller block
+        {
+            rows /= 2;
+        }
+    }
+
+    if (rows < 2)
+    {
+        Printf("Statement cannot be batched, importing row by row.\n");
+        delete batch;
+        return 0;
+    }
+    batch->capacity = rows;
+    Printf("Inserting up to %d rows at once.\n", rows);
+    return batch;
+}
+
+// copies parameters of import statement to next free row of batch
+// returns true if batch is full and should be executed
+bool FBExport::QueueRow(IBPP::Statement& st, ImportBatch *batch)
+{
+    int first = batch->rows * batch->params;
+    for (int j=1; j<=batch->params; j++)
+        batch->block->CopyParameter(first + j, st, j);
+    return (++batch->rows == batch->capacity);
+}
+
+// Block for given number of rows with parameters of queued rows starting
+// at first. Blocks smaller than batch are prepared on first use. Returns
+// null statement if block of that size cannot be prepared
+IBPP::Statement FBExport::BatchBlock(IBPP::Statement& st, ImportBatch *batch,
+    int first, int rows)
+{
+    if (rows == batch->capacity)
+        return batch->block;
+
+    map<int, IBPP::Statement>::iterator it = batch->parts.find(rows);
+    if (it == batch->parts.end())
+    {
+        IBPP::Statement part = IBPP::StatementFactory(st->DatabasePtr(),
+            st->TransactionPtr());
+        try
+        {
+            part->Prepare(BlockSQL(batch, rows));
+        }
+        catch (IBPP::Exception &)
+        {
+            part = IBPP::Statement();   // rows go one by one
+        }
+        it = batch->parts.insert(make_pair(rows, part)).first;
+    }
+
+    IBPP::Statement block = it->second;
+    if (block.intf())
+    {
+        int params = batch->params;
+        for (int j=1; j<=rows*params; j++)
+            block->CopyParameter(j, batch->block, first*params + j);
+    }
+    return block;
+}
+
+// Executes queued rows first .. first+rows-1 as one block. Server undoes
+// the whole block if any of its rows fails, so block is then split in half
+// and each half is tried again, until failed rows are found one by one.
+// Indexes of failed rows are added to failed, returns number of rows inserted
+int FBExport::ExecuteRows(IBPP::Statement& st, ImportBatch *batch, int first,
+    int rows, vector<int>& failed)
+{
+    if (rows > 1)
+    {
+        IBPP::Statement block = BatchBlock(st, batch, first, rows);
+        if (block.intf())
+        {
+            try
+            {
+                block->Execute();
+                return rows;
+            }
+            catch (IBPP::Exception &)   // nothing is inserted
+            {
+            }
+            int half = rows / 2;
+            return ExecuteRows(st, batch, first, half, failed)
+                + ExecuteRows(st, batch, first + half, rows - half, failed);
+        }
+    }
+
+    int inserted = 0;
+    int params = batch->params;
+    for (int r = first; r < first + rows; r++)
+    {
+        try
+        {
+            for (int j=1; j<=params; j++)
+                st->CopyParameter(j, batch->block, r*params + j);
+            st->Execute();
+            inserted++;
+        }
+        catch (IBPP::Exception &e)
+        {
+            Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+            failed.push_back(r);
+        }
+    }
+    return inserted;
+}
+
+// Executes queued rows, indexes of rows that failed are added to failed
+// returns number of rows inserted
+int FBExport::ExecuteBatch(IBPP::Statement& st, ImportBatch *batch,
+    vector<int>& failed)
+{
+    int queued = batch->rows;
+    batch->rows = 0;
+    return ExecuteRows(st, batch, 0, queued, failed);
+}
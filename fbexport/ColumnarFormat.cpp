@@ -0,0 +1,628 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : ColumnarFormat.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Columnar layout of fbx file (-Sb). Rows are written in
+//                blocks, each block stores values column by column
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Block layout:
+//      4 bytes         number of rows in block
+//  then for each column:
+//      1 byte          column type (same as in file header)
+//      4 bytes         size of the rest of this column
+//      (rows+7)/8      null bitmap, bit (row % 8) of byte (row / 8) is set for NULL
+//      values of rows that are not NULL:
+//          numbers, dates and times: binary, as in row layout
+//          strings: 2 byte length of each value, followed by all the values
+//          blobs: segments, as in row layout (without the NULL flag)
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+// one column of a block being written
+struct ColumnChunk
+{
+    string nulls;
+    string lengths;             // strings only
+    string data;
+};
+
+// one column of a block read from file
+struct ColumnData
+{
+    IBPP::SDT type;
+    const char *raw;            // as stored in file, points into mapped file
+    string copy;                // or here, if file is not mapped
+    vector<int> offset;         // of each row's value in raw, -1 for NULL
+    vector<int> length;
+    vector<int64_t> ints;       // integers, dates, times and dates of timestamps
+    vector<int> times;          // times of timestamps
+    vector<double> reals;       // floats and doubles
+};
+
+#define FETCH_BLOCK_ROWS 512    // rows fetched at once, block size is checked after each
+
+// size of binary value, 0 for strings and blobs
+int valueWidth(IBPP::SDT type)
+{
+    switch (type)
+    {
+        case IBPP::sdSmallint:
+            return 2;
+        case IBPP::sdInteger:
+        case IBPP::sdFloat:
+        case IBPP::sdDate:
+        case IBPP::sdTime:
+            return 4;
+        case IBPP::sdLargeint:
+        case IBPP::sdDouble:
+        case IBPP::sdTimestamp:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// length of blob segment, written as 4 ASCII digits. -1 if invalid
+int segmentLength(const char *p)
+{
+    int len = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        len = len * 10 + (p[i] - '0');
+    }
+    return len;
+}
+
+// appends blob data in the same form as WriteBlob() does, without NULL flag
+void FBExport::AppendBlob(string& dest, IBPP::Blob& b)
+{
+    b->Open();
+    char segment[4 + 8192];
+    int size;
+    do
+    {
+        size = b->Read(segment + 4, 8192);
+        for (int i = 3, x = size; i >= 0; i--, x /= 10)
+            segment[i] = (char)('0' + x % 10);
+        dest.append(segment, 4 + size);
+    }
+    while (size > 0);
+    b->Close();
+}
+
+// appends count values per row of fixed size type T, stored as U in file
+template <class T, class U>
+void appendValues(string& dest, IBPP::RowBlock& block, int col, int count)
+{
+    const T *values = block.Values<T>(col);
+    char buff[8];
+    for (int r = 0; r < block.rows; r++)
+    {
+        if (block.IsNull(col, r))
+            continue;
+        for (int i = 0; i < count; i++)
+        {
+            U bits;
+            memcpy(&bits, &values[r * count + i], sizeof(U));
+            encodeLE(buff, bits, sizeof(U));
+            dest.append(buff, sizeof(U));
+        }
+    }
+}
+
+// appends values of column col of fetched rows to chunk, which already
+// holds given number of rows. type is the one written in file header
+void FBExport::AppendColumn(ColumnChunk& c, IBPP::Statement& st, IBPP::RowBlock& block,
+    int col, IBPP::SDT type, int rows, IBPP::Blob& blob)
+{
+    for (int r = 0; r < block.rows; r++, rows++)
+    {
+        if (rows % 8 == 0)
+            c.nulls += '\0';
+        if (block.IsNull(col, r))
+            c.nulls[rows / 8] |= (char)(1 << (rows % 8));
+    }
+
+    char buff[2];
+    switch (block.columns[col].type)
+    {
+        case IBPP::sdString:
+            for (int r = 0; r < block.rows; r++)
+            {
+                if (block.IsNull(col, r))
+                    continue;
+                int len;
+                const char *value = block.String(col, r, len);
+                if (ar->TrimChars)
+                    while (len > 0 && value[len - 1] == ' ')
+                        len--;
+                encodeLE(buff, len, 2);
+                c.lengths.append(buff, 2);
+                c.data.append(value, len);
+            }
+            break;
+        case IBPP::sdBlob:
+            for (int r = 0; r < block.rows; r++)
+                if (!st->Get(block, col, r, blob))
+                    AppendBlob(c.data, blob);
+            break;
+        case IBPP::sdSmallint:
+            appendValues<int16_t, uint16_t>(c.data, block, col, 1);
+            break;
+        case IBPP::sdDate:
+            if (type != IBPP::sdTimestamp)
+                appendValues<int32_t, uint32_t>(c.data, block, col, 1);
+            else                            // dialect 1, time is 0
+            {
+                char ts[8] = { 0 };
+                for (int r = 0; r < block.rows; r++)
+                {
+                    if (block.IsNull(col, r))
+                        continue;
+                    encodeLE(ts, (uint32_t)block.Values<int32_t>(col)[r], 4);
+                    c.data.append(ts, 8);
+                }
+            }
+            break;
+        case IBPP::sdInteger:
+        case IBPP::sdTime:
+            appendValues<int32_t, uint32_t>(c.data, block, col, 1);
+            break;
+        case IBPP::sdTimestamp:     // date and time
+            appendValues<int32_t, uint32_t>(c.data, block, col, 2);
+            break;
+        case IBPP::sdFloat:
+            appendValues<float, uint32_t>(c.data, block, col, 1);
+            break;
+        case IBPP::sdLargeint:
+            appendValues<int64_t, uint64_t>(c.data, block, col, 1);
+            break;
+        case IBPP::sdDouble:
+            appendValues<double, uint64_t>(c.data, block, col, 1);
+            break;
+        default:
+            Printf("\nWARNING: Datatype not supported by this version of fbexport!!!\n");
+    }
+}
+
+// writes collected rows as one block, and clears the chunks
+void FBExport::WriteColumnBlock(OutputSink& out, vector<IBPP::SDT>& types,
+    vector<ColumnChunk>& chunks, int rows)
+{
+    char num[4];
+    encodeLE(num, rows, 4);
+    out.Write(num, 4);
+    for (size_t i = 1; i < chunks.size(); i++)
+    {
+        ColumnChunk& c = chunks[i];
+        out.Put(SDT2uc(types[i]));
+        encodeLE(num, c.nulls.length() + c.lengths.length() + c.data.length(), 4);
+        out.Write(num, 4);
+        out.Write(c.nulls);
+        out.Write(c.lengths);
+        out.Write(c.data);
+        c.nulls.erase();
+        c.lengths.erase();
+        c.data.erase();
+    }
+}
+
+// statement is executed, fetch all rows into output, in blocks. Rows are
+// fetched FETCH_BLOCK_ROWS at a time and encoded column by column
+// returns: # of rows exported, -1 on error
+int FBExport::ExportBlocks(IBPP::Statement& st, OutputSink& out, int worker)
+{
+    int fc = st->Columns();
+    vector<IBPP::SDT> types;
+    FileTypes(st, types);
+    vector<ColumnChunk> chunks(fc + 1);
+    IBPP::RowBlock block;
+    IBPP::Blob blob = IBPP::BlobFactory(st->DatabasePtr(), st->TransactionPtr());
+
+    int ret = 0;
+    int rows = 0;               // in current block
+    size_t bytes = 0;
+    bool more = true;
+    while (more)
+    {
+        st->FetchBlock(block, min(FETCH_BLOCK_ROWS, FBX_BLOCK_ROWS - rows));
+        more = !block.eof;
+        for (int i=1; i<=fc; i++)
+        {
+            ColumnChunk& c = chunks[i];
+            size_t before = c.data.length();
+            AppendColumn(c, st, block, i, types[i], rows, blob);
+            bytes += c.data.length() - before;
+        }
+        rows += block.rows;
+
+        // print checkpoints (exporting, no commit needed)
+        for (int r = ret; r < ret + block.rows; r++)
+        {
+            if (r % ar->CheckPoint == 0 && r)
+            {
+                if (worker)
+                    Printf("Worker %d checkpoint at: %d lines.\n", worker, r);
+                else
+                    Printf("Checkpoint at: %d lines.\n", r);
+            }
+        }
+        ret += block.rows;
+
+        if (rows > 0 && (!more || rows == FBX_BLOCK_ROWS || bytes >= FBX_BLOCK_BYTES))
+        {
+            WriteColumnBlock(out, types, chunks, rows);
+            out.EndRow();       // block is never split between workers' output
+            if (out.Failed())
+            {
+                Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+                return -1;
+            }
+            rows = 0;
+            bytes = 0;
+        }
+    }
+    return ret;
+}
+
+// reads one column of a block and decodes all its values in a loop for
+// that type. Returns false if data is not valid
+bool FBExport::ReadColumn(InputSource& in, ColumnData& c, IBPP::SDT type, int rows)
+{
+    char head[5];
+    if (in.Read(head, 5) != 5 || (IBPP::SDT)(unsigned char)head[0] != type)
+        return false;
+    size_t size = (uint32_t)decodeLE(head + 1, 4);
+    c.type = type;
+    if (in.Mapped())
+    {
+        c.raw = in.View(size);
+        if (!c.raw)
+            return false;
+    }
+    else
+    {
+        c.copy.resize(size);
+        if (size && in.Read(&c.copy[0], size) != size)
+            return false;
+        c.raw = c.copy.data();
+    }
+
+    size_t pos = ((size_t)rows + 7) / 8;    // values follow the null bitmap
+    if (pos > size)
+        return false;
+    const char *raw = c.raw;
+    c.offset.resize(rows);
+    c.length.resize(rows);
+    for (int r = 0; r < rows; r++)
+        c.offset[r] = ((raw[r / 8] >> (r % 8)) & 1) ? -1 : 0;
+
+    // find where each value is
+    if (type == IBPP::sdString)
+    {
+        size_t lengths = pos;       // lengths of all values come first
+        for (int r = 0; r < rows; r++)
+            if (c.offset[r] == 0)
+                pos += 2;
+        if (pos > size)
+            return false;
+        for (int r = 0; r < rows; r++)
+        {
+            if (c.offset[r] < 0)
+                continue;
+            c.offset[r] = (int)pos;
+            c.length[r] = (int)(uint16_t)decodeLE(raw + lengths, 2);
+            lengths += 2;
+            pos += c.length[r];
+        }
+    }
+    else if (type == IBPP::sdBlob)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            if (c.offset[r] < 0)
+                continue;
+            c.offset[r] = (int)pos;
+            while (true)
+            {
+                int len = (pos + 4 <= size ? segmentLength(raw + pos) : -1);
+                if (len < 0)
+                    return false;
+                pos += 4 + len;
+                if (len == 0)
+                    break;
+            }
+            c.length[r] = (int)pos - c.offset[r];
+        }
+    }
+    else
+    {
+        int width = valueWidth(type);
+        for (int r = 0; r < rows; r++)
+        {
+            if (c.offset[r] < 0)
+                continue;
+            c.offset[r] = (int)pos;
+            c.length[r] = width;
+            pos += width;
+        }
+    }
+    if (pos != size)
+        return false;
+
+    // decode values, so binding only needs to copy them
+    switch (type)
+    {
+        case IBPP::sdSmallint:
+        case IBPP::sdInteger:
+        case IBPP::sdLargeint:
+        case IBPP::sdDate:
+        case IBPP::sdTime:
+        {
+            int width = valueWidth(type);
+            c.ints.resize(rows);
+            for (int r = 0; r < rows; r++)
+                if (c.offset[r] >= 0)
+                    c.ints[r] = decodeLE(raw + c.offset[r], width);
+            break;
+        }
+        case IBPP::sdTimestamp:
+            c.ints.resize(rows);
+            c.times.resize(rows);
+            for (int r = 0; r < rows; r++)
+            {
+                if (c.offset[r] < 0)
+                    continue;
+                c.ints[r] = decodeLE(raw + c.offset[r], 4);
+                c.times[r] = (int)decodeLE(raw + c.offset[r] + 4, 4);
+            }
+            break;
+        case IBPP::sdFloat:
+            c.reals.resize(rows);
+            for (int r = 0; r < rows; r++)
+            {
+                if (c.offset[r] < 0)
+                    continue;
+                uint32_t bits = (uint32_t)decodeLE(raw + c.offset[r], 4);
+                float f;
+                memcpy(&f, &bits, 4);
+                c.reals[r] = f;
+            }
+            break;
+        case IBPP::sdDouble:
+            c.reals.resize(rows);
+            for (int r = 0; r < rows; r++)
+            {
+                if (c.offset[r] < 0)
+                    continue;
+                uint64_t bits = (uint64_t)decodeLE(raw + c.offset[r], 8);
+                memcpy(&c.reals[r], &bits, 8);
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// binds value of column col (in file) in given row to all its parameters,
+// as given by Plan (integers are rescaled by its factors)
+void FBExport::BindColumn(IBPP::Statement& st, ColumnData& c, int col, int row)
+{
+    ColumnPlan& plan = Plan[col-1];
+    vector<int>& params = plan.params;
+    int off = c.offset[row];
+
+    IBPP::Blob b;
+    if (off >= 0 && c.type == IBPP::sdBlob)
+    {
+        b = IBPP::BlobFactory(st->DatabasePtr(), st->TransactionPtr());
+        b->Create();
+        const char *p = c.raw + off;
+        int len;
+        while ((len = segmentLength(p)) > 0)
+        {
+            b->Write(p + 4, len);
+            p += 4 + len;
+        }
+        b->Close();
+    }
+
+    for (size_t k = 0; k < params.size(); k++)
+    {
+        int j = params[k];
+        if (off < 0)
+        {
+            st->SetNull(j);
+            continue;
+        }
+
+        switch (c.type)
+        {
+            case IBPP::sdString:
+                st->SetRaw(j, c.raw + off, c.length[row]);
+                break;
+            case IBPP::sdBlob:
+                st->Set(j, b);
+                break;
+            case IBPP::sdSmallint:
+            case IBPP::sdInteger:
+            case IBPP::sdLargeint:
+                setRawInteger(st, j, c.type, scaleInteger(c.ints[row], plan.factors[k]));
+                break;
+            case IBPP::sdDate:
+                setRawDate(st, j, (int)c.ints[row]);
+                break;
+            case IBPP::sdTime:
+                setRawTime(st, j, (int)c.ints[row]);
+                break;
+            case IBPP::sdTimestamp:
+                setRawTimestamp(st, j, (int)c.ints[row], c.times[row]);
+                break;
+            case IBPP::sdFloat:
+            {
+                float f = (float)c.reals[row];
+                st->SetRaw(j, &f, 4);
+                break;
+            }
+            case IBPP::sdDouble:
+                st->SetRaw(j, &c.reals[row], 8);
+                break;
+
+            default:
+                Printf("\nWARNING! Unsupported datatype... value set to NULL\n");
+                st->SetNull(j);
+        }
+    }
+}
+
+// imports file in columnar layout. Each block is read and decoded column
+// by column, and then its rows are bound and executed (or queued into
+// batch, which is flushed at the end of each block)
+// returns number of rows inserted, or -1 if error
+int FBExport::ImportBlocks(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+    ImportBatch *batch)
+{
+    int Errors = 0;
+    int ret = 0;    // number of rows entered - counter
+    vector<ColumnData> cols(fieldcount);
+
+    // values of queued rows, to show the rows that fail
+    int slots = (batch ? batch->capacity : 1);
+    vector<string> rowData;                     // not used, data is in cols
+    vector<int> fieldLen(slots * fieldcount);
+    vector<const char *> fieldPtr(slots * fieldcount);
+    int slot = 0;
+    while (true)
+    {
+        char num[4];
+        size_t got = in.Read(num, 4);
+        if (got == 0)
+            break;              // end of file
+        int rows = (int)decodeLE(num, 4);
+        if (got != 4 || rows <= 0)
+        {
+            Printf("\nFile seems corrupt (reason 4), bailing out...\n");
+            return -1;
+        }
+        for (int i=0; i<fieldcount; i++)
+        {
+            if (!ReadColumn(in, cols[i], ft[i], rows))
+            {
+                Printf("\nFile seems corrupt (reason 5), bailing out...\n");
+                return -1;
+            }
+        }
+
+        for (int r = 0; r < rows; r++)
+        {
+            bool ErrorInHere = false;
+            for (int i=0; i<fieldcount && !ErrorInHere; i++)
+            {
+                if (Plan[i].params.empty())
+                    continue;
+                try
+                {
+                    BindColumn(st, cols[i], i+1, r);
+                }
+                catch (IBPP::Exception &e)
+                {
+                    Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                    Printf("\nCurrent field: %d of %d.\n", i+1, fieldcount);
+                    ErrorInHere = true;
+                }
+            }
+
+            int base = slot * fieldcount;
+            for (int i=0; i<fieldcount; i++)
+            {
+                int off = cols[i].offset[r];
+                fieldPtr[base + i] = (off < 0 ? 0 : cols[i].raw + off);
+                fieldLen[base + i] = (off < 0 || ft[i] == IBPP::sdBlob ? -1
+                    : cols[i].length[r]);
+            }
+
+            if (!ErrorInHere && batch)
+            {
+                slot++;
+                if (QueueRow(st, batch))
+                {
+                    if (FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen))
+                        return ret;
+                    slot = 0;
+                }
+                continue;
+            }
+
+            if (!ErrorInHere)
+            {
+                try
+                {
+                    st->Execute();
+                    ret++;          // increase row counter
+                }
+                catch (IBPP::Exception &e)
+                {
+                    Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                    ErrorInHere = true;
+                }
+            }
+
+            if (ErrorInHere)
+            {
+                BinaryRowData(ft, &fieldPtr[base], &fieldLen[base]);
+                if (RowFailed(Errors))
+                    return ret;
+            }
+
+            if (!batch)
+                ImportCheckpoint(st, ret, ret - 1);
+        }
+
+        if (slot > 0)       // rest of the block, cols are reused for next one
+        {
+            if (FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen))
+                return ret;
+            slot = 0;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,227 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : Compression.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Compression of fbx data (LZ4 block format)
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "Compression.h"
+
+#define HASH_BITS       14
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // format requires last bytes to be literals
+#define MATCH_LIMIT     12      // no match may start closer to the end
+#define MAX_OFFSET      65535
+
+inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// writes remainder of length which didn't fit into 4 bits of token
+inline unsigned char *putLength(unsigned char *out, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *out++ = 255;
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+// greedy LZ77 with a single hash table, returns size of packed data
+size_t compressBlock(const char *source, size_t len, char *dest)
+{
+    const unsigned char *src = (const unsigned char *)source;
+    const unsigned char *end = src + len;
+    const unsigned char *anchor = src;      // start of literals not written yet
+    unsigned char *out = (unsigned char *)dest;
+
+    if (len > MATCH_LIMIT)
+    {
+        std::vector<uint32_t> table(1 << HASH_BITS, 0);
+        const unsigned char *matchLimit = end - LAST_LITERALS;
+        const unsigned char *p = src + 1;
+        unsigned misses = 0;
+        while (p < end - MATCH_LIMIT)
+        {
+            uint32_t seq = read32(p);
+            uint32_t h = hash32(seq);
+            const unsigned char *ref = src + table[h];
+            table[h] = (uint32_t)(p - src);
+            if (p - ref > MAX_OFFSET || read32(ref) != seq)
+            {
+                p += 1 + (misses++ >> 6);   // skip faster over data that doesn't compress
+                continue;
+            }
+            misses = 0;
+
+            const unsigned char *m = p + MIN_MATCH;
+            const unsigned char *r = ref + MIN_MATCH;
+            while (m < matchLimit && *m == *r)
+            {
+                m++;
+                r++;
+            }
+
+            size_t literals = p - anchor;
+            size_t matchLen = m - p - MIN_MATCH;
+            unsigned char *token = out++;
+            *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+            if (literals >= 15)
+                out = putLength(out, literals - 15);
+            memcpy(out, anchor, literals);
+            out += literals;
+
+            size_t offset = p - ref;
+            *out++ = (unsigned char)(offset & 0xFF);
+            *out++ = (unsigned char)(offset >> 8);
+            *token |= (unsigned char)(matchLen < 15 ? matchLen : 15);
+            if (matchLen >= 15)
+                out = putLength(out, matchLen - 15);
+
+            p = anchor = m;
+        }
+    }
+
+    // the rest is written as literals
+    size_t literals = end - anchor;
+    *out++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15)
+        out = putLength(out, literals - 15);
+    memcpy(out, anchor, literals);
+    out += literals;
+    return out - (unsigned char *)dest;
+}
+
+size_t compressFrameBound(size_t len)
+{
+    return COMPRESS_FRAME_HEADER + len + len / 255 + 16;
+}
+
+void put32(char *dest, size_t value)
+{
+    for (int i = 0; i < 4; i++, value >>= 8)
+        dest[i] = (char)(value & 0xFF);
+}
+
+size_t get32(const char *src)
+{
+    const unsigned char *p = (const unsigned char *)src;
+    return (size_t)p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+size_t compressFrame(const char *src, size_t len, char *frame)
+{
+    size_t packed = compressBlock(src, len, frame + COMPRESS_FRAME_HEADER);
+    if (packed >= len)      // store it as it is
+    {
+        memcpy(frame + COMPRESS_FRAME_HEADER, src, len);
+        packed = len;
+    }
+    put32(frame, len);
+    put32(frame + 4, packed);
+    return COMPRESS_FRAME_HEADER + packed;
+}
+
+bool frameSizes(const char *header, size_t& len, size_t& packed)
+{
+    len = get32(header);
+    packed = get32(header + 4);
+    return (len > 0 && len <= COMPRESS_FRAME_MAX && packed > 0 && packed <= len);
+}
+
+// reads remainder of length, returns false if input ends
+inline bool getLength(const unsigned char *&in, const unsigned char *end, size_t& len)
+{
+    unsigned char b;
+    do
+    {
+        if (in >= end)
+            return false;
+        b = *in++;
+        len += b;
+    }
+    while (b == 255);
+    return true;
+}
+
+bool decompressFrame(const char *packed, size_t packedLen, char *dest, size_t len)
+{
+    if (packedLen == len)   // stored as is
+    {
+        memcpy(dest, packed, len);
+        return true;
+    }
+
+    const unsigned char *in = (const unsigned char *)packed;
+    const unsigned char *inEnd = in + packedLen;
+    unsigned char *out = (unsigned char *)dest;
+    unsigned char *outEnd = out + len;
+    while (in < inEnd)
+    {
+        unsigned token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(in, inEnd, literals))
+            return false;
+        if (literals > (size_t)(inEnd - in) || literals > (size_t)(outEnd - out))
+            return false;
+        memcpy(out, in, literals);
+        out += literals;
+        in += literals;
+        if (in == inEnd)    // last sequence has no match
+            break;
+
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - (unsigned char *)dest))
+            return false;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !getLength(in, inEnd, matchLen))
+            return false;
+        matchLen += MIN_MATCH;
+        if (matchLen > (size_t)(outEnd - out))
+            return false;
+
+        const unsigned char *m = out - offset;
+        if (offset >= matchLen)
+        {
+            memcpy(out, m, matchLen);
+            out += matchLen;
+        }
+        else                // overlapping, i.e. repeated bytes
+        {
+            while (matchLen--)
+                *out++ = *m++;
+        }
+    }
+    return (out == outEnd);
+}
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : Compression.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Block compression of fbx data. Data is split into
+//                independent frames which can be packed in parallel. Format of
+//                compressed frame is LZ4 block format, no external library needed
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef CompressionH
+#define CompressionH
+
+#include <stddef.h>
+
+#define COMPRESS_BLOCK_SIZE (256*1024)      // data in one frame, before compression
+#define COMPRESS_FRAME_MAX  (16*1024*1024)  // readers reject larger frames
+
+// Frame: 4 bytes   size of data (little-endian)
+//        4 bytes   size of packed data, if it is the same as size of data,
+//                  data is stored as is (it could not be compressed)
+//        packed data
+#define COMPRESS_FRAME_HEADER 8
+
+// buffer for frame must be this big
+size_t compressFrameBound(size_t len);
+
+// packs len bytes (len <= COMPRESS_FRAME_MAX) into a frame, returns frame size
+size_t compressFrame(const char *src, size_t len, char *frame);
+
+// reads frame header, returns false if it is not valid
+bool frameSizes(const char *header, size_t& len, size_t& packed);
+
+// unpacks packed data of a frame, returns false if data is corrupt
+bool decompressFrame(const char *packed, size_t packedLen, char *dest, size_t len);
+
+#endif
@@ -0,0 +1,696 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : CsvImport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Import of CSV files (-Ic). Input is split into chunks
+//                at record boundaries which are parsed by several threads
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "ParseArgs.h"
+#include "TextKernels.h"
+#include "FBExport.h"
+
+#define CSV_CHUNK_SIZE      (4 * 1024 * 1024)   // bytes parsed by one thread
+#define CSV_CHUNK_MINIMUM   (64 * 1024)         // smaller input is not split
+
+// value of one field, points into input or into CsvChunk::unescaped
+struct CsvField
+{
+    const char *data;
+    int len;                    // -1 = NULL (empty field without quotes)
+};
+
+// whole records of input, parsed by one thread
+struct CsvChunk
+{
+    const char *data;
+    size_t len;
+    string unescaped;           // quoted values that contained ""
+    vector<CsvField> fields;    // of all records
+    vector<size_t> records;     // first field of each record, and the end
+    vector<size_t> starts;      // offset of each record in data, and the end
+    string error;               // empty if whole chunk was parsed
+};
+
+// input read at once, one chunk for each thread
+struct CsvWindow
+{
+    string buffer;              // copy of input, unless file is mapped
+    vector<CsvChunk> chunks;
+};
+
+// finds ends of records (newlines outside of quotes) where input can be cut
+// into chunks of about size bytes. Data has to start at a record. Like
+// parseCsv, a quote only opens a value at the start of a field. Returns the
+// end of the last complete record
+static size_t splitCsv(const char *data, size_t len, size_t size,
+    char separator, vector<size_t>& cuts)
+{
+    bool quoted = false;
+    size_t complete = 0;
+    size_t next = size;
+    size_t pos = findAny(data, len, "\"\n");
+    while (pos < len)
+    {
+        if (data[pos] == '"')
+        {
+            if (quoted)
+            {
+                if (pos + 1 < len && data[pos + 1] == '"')     // "" = one quote
+                    pos++;
+                else
+                    quoted = false;
+            }
+            else if (pos == 0 || data[pos - 1] == separator
+                || data[pos - 1] == '\n' || data[pos - 1] == '\r')
+            {
+                quoted = true;
+            }
+        }
+        else if (!quoted)
+        {
+            complete = pos + 1;
+            if (complete >= next && complete < len)
+            {
+                cuts.push_back(complete);
+                next = complete + size;
+            }
+        }
+        pos++;
+        pos += findAny(data + pos, len - pos, "\"\n");
+    }
+    return complete;
+}
+
+// parses records of chunk (RFC 4180), runs in its own thread. Parsing stops
+// at malformed record, records before it are kept
+static void parseCsv(CsvChunk *c, char separator)
+{
+    c->fields.clear();
+    c->records.clear();
+    c->starts.clear();
+    c->error.clear();
+    c->unescaped.clear();
+    c->unescaped.reserve(c->len);   // so pointers to it stay valid
+
+    const char stops[4] = { separator, '\r', '\n', 0 };
+    const char *p = c->data;
+    const char *end = c->data + c->len;
+    while (p < end)
+    {
+        if (*p == '\r' || *p == '\n')   // empty lines are skipped
+        {
+            p++;
+            continue;
+        }
+        c->records.push_back(c->fields.size());
+        c->starts.push_back(p - c->data);
+        while (true)        // fields of record
+        {
+            CsvField f;
+            if (p < end && *p == '"')
+            {
+                const char *q = p + 1;
+                size_t copied = string::npos;   // start in unescaped
+                while (true)
+                {
+                    const char *e = q + findAny(q, end - q, "\"");
+                    if (e == end)
+                    {
+                        c->error = "missing closing quote";
+                        break;
+                    }
+                    if (e + 1 < end && e[1] == '"')     // "" = one quote
+                    {
+                        if (copied == string::npos)
+                        {
+                            copied = c->unescaped.length();
+                            c->unescaped.append(p + 1, e + 1 - (p + 1));
+                        }
+                        else
+                            c->unescaped.append(q, e + 1 - q);
+                        q = e + 2;
+                        continue;
+                    }
+                    if (copied == string::npos)
+                    {
+                        f.data = p + 1;
+                        f.len = (int)(e - f.data);
+                    }
+                    else
+                    {
+                        c->unescaped.append(q, e - q);
+                        f.data = c->unescaped.data() + copied;
+                        f.len = (int)(c->unescaped.length() - copied);
+                    }
+                    p = e + 1;
+                    break;
+                }
+                if (!c->error.empty())
+                    break;
+            }
+            else
+            {
+                size_t n = findAny(p, end - p, stops);
+                f.data = p;
+                f.len = (n == 0 ? -1 : (int)n);
+                p += n;
+            }
+            c->fields.push_back(f);
+
+            if (p == end)
+                break;
+            if (*p == separator)
+            {
+                p++;
+                continue;
+            }
+            if (*p == '\r' || *p == '\n')
+            {
+                if (*p == '\r')
+                    p++;
+                if (p < end && *p == '\n')
+                    p++;
+                break;
+            }
+            c->error = "separator or end of line expected after closing quote";
+            break;
+        }
+        if (!c->error.empty())      // drop the malformed record
+        {
+            c->fields.resize(c->records.back());
+            c->records.pop_back();
+            p = c->data + c->starts.back();
+            c->starts.pop_back();
+            break;
+        }
+    }
+    c->records.push_back(c->fields.size());
+    c->starts.push_back(p - c->data);
+}
+
+// hands out the input in windows of whole records
+class CsvReader
+{
+private:
+    InputSource& inM;
+    const char *mappedM;        // rest of mapped file
+    size_t mappedLenM;
+    string carryM;              // incomplete record of previous window
+    bool eofM;
+    bool startM;
+    char separatorM;
+
+public:
+    CsvReader(InputSource& in, char separator);
+    bool Next(CsvWindow& w, int chunks);    // false at end of input
+};
+
+CsvReader::CsvReader(InputSource& in, char separator)
+    : inM(in), mappedM(0), mappedLenM(0), eofM(false), startM(true),
+      separatorM(separator)
+{
+    if (inM.Mapped())
+        mappedM = inM.ViewBlock(mappedLenM);
+}
+
+bool CsvReader::Next(CsvWindow& w, int chunks)
+{
+    size_t want = (size_t)chunks * CSV_CHUNK_SIZE;
+    w.buffer.swap(carryM);
+    carryM.clear();
+
+    const char *data;
+    size_t len;
+    size_t complete;
+    vector<size_t> cuts;
+    while (true)
+    {
+        if (inM.Mapped())
+        {
+            len = (mappedLenM < want ? mappedLenM : want);
+            eofM = (len == mappedLenM);
+        }
+        else
+        {
+            while (w.buffer.length() < want && !eofM)
+            {
+                size_t n;
+                const char *block = inM.ViewBlock(n);
+                if (n == 0)
+                    eofM = true;
+                else
+                    w.buffer.append(block, n);
+            }
+            len = w.buffer.length();
+        }
+
+        if (startM)     // UTF-8 byte order mark, written by some tools
+        {
+            startM = false;
+            const char *bom = "\xEF\xBB\xBF";
+            if (inM.Mapped() && len >= 3 && memcmp(mappedM, bom, 3) == 0)
+            {
+                mappedM += 3;
+                mappedLenM -= 3;
+                len -= 3;
+            }
+            else if (!inM.Mapped() && w.buffer.compare(0, 3, bom) == 0)
+            {
+                w.buffer.erase(0, 3);
+                len -= 3;
+            }
+        }
+        data = (inM.Mapped() ? mappedM : w.buffer.data());
+
+        size_t size = len / chunks + 1;
+        if (size < CSV_CHUNK_MINIMUM)
+            size = CSV_CHUNK_MINIMUM;
+        cuts.clear();
+        complete = splitCsv(data, len, size, separatorM, cuts);
+        if (eofM)
+            complete = len;     // last record may have no newline
+        if (complete > 0 || eofM)
+            break;
+        want *= 2;              // record is longer than the window
+    }
+    if (complete == 0)
+        return false;
+
+    if (inM.Mapped())
+    {
+        mappedM += complete;
+        mappedLenM -= complete;
+    }
+    else
+    {
+        carryM.assign(w.buffer, complete, string::npos);
+        w.buffer.resize(complete);
+        data = w.buffer.data();
+    }
+
+    if (cuts.empty() || cuts.back() < complete)
+        cuts.push_back(complete);
+    w.chunks.resize(cuts.size());
+    size_t from = 0;
+    for (size_t i = 0; i < cuts.size(); i++)
+    {
+        w.chunks[i].data = data + from;
+        w.chunks[i].len = cuts[i] - from;
+        from = cuts[i];
+    }
+    return true;
+}
+
+// parsing runs while rows of previous window are imported
+static void startParsing(CsvWindow& w, char separator, vector<std::thread>& threads)
+{
+    for (size_t i = 0; i < w.chunks.size(); i++)
+        threads.push_back(std::thread(parseCsv, &w.chunks[i], separator));
+}
+static void joinAll(vector<std::thread>& threads)
+{
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+}
+
+// true if name can be used in SQL without quotes
+static bool plainIdentifier(const string& name)
+{
+    if (name.empty() || !isalpha((unsigned char)name[0]))
+        return false;
+    for (string::const_iterator c = name.begin(); c != name.end(); ++c)
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != '$')
+            return false;
+    return true;
+}
+
+// first record has the names of columns. They are used in INSERT if -V is
+// given, otherwise only their count matters
+bool FBExport::CsvHeader(CsvChunk& c)
+{
+    if (c.records.size() < 2)   // first record is malformed
+    {
+        Printf("CSV header is malformed (%s).\n", c.error.c_str());
+        return false;
+    }
+
+    fieldcount = (int)(c.records[1] - c.records[0]);
+    string colist;
+    for (int i=0; i<fieldcount; i++)
+    {
+        CsvField& f = c.fields[c.records[0] + i];
+        string name;
+        if (f.len > 0)
+            name.assign(f.data, f.len);
+        name.erase(name.find_last_not_of(' ') + 1);
+        name.erase(0, name.find_first_not_of(' '));
+        if (name.empty())
+        {
+            Printf("Name of column %d is missing in CSV header.\n", i+1);
+            return false;
+        }
+
+        if (i)
+            colist += ",";
+        if (plainIdentifier(name))
+            colist += name;
+        else
+        {
+            colist += '"';
+            for (string::iterator ch = name.begin(); ch != name.end(); ++ch)
+            {
+                if (*ch == '"')
+                    colist += '"';
+                colist += *ch;
+            }
+            colist += '"';
+        }
+    }
+
+    if (ar->VerbatimCopyTable != "")
+        ar->SQL = "INSERT INTO " + ar->VerbatimCopyTable + " (" + colist + ") ";
+    return true;
+}
+
+// like CompilePlan(), but values are text which is converted to the type of
+// each parameter
+void FBExport::CompileCsvPlan(IBPP::Statement& st)
+{
+    Plan.assign(fieldcount, ColumnPlan());
+    for (int i=0; i<fieldcount; i++)
+    {
+        ColumnPlan& p = Plan[i];
+        p.bind = 0;
+        ParamMap::iterator it = parmap.find(i+1);
+        if (it == parmap.end())
+            continue;
+        for (set<int>::iterator j = it->second.begin(); j != it->second.end(); ++j)
+        {
+            IBPP::SDT type = st->ParameterType(*j);
+            switch (type)
+            {
+                case IBPP::sdString:    case IBPP::sdSmallint:
+                case IBPP::sdInteger:   case IBPP::sdLargeint:
+                case IBPP::sdFloat:     case IBPP::sdDouble:
+                case IBPP::sdDate:      case IBPP::sdTime:
+                case IBPP::sdTimestamp: case IBPP::sdBlob:
+                    break;
+                default:
+                    Printf("\nWARNING! Unsupported datatype of parameter %d... value set to NULL\n", *j);
+                    continue;
+            }
+            p.params.push_back(*j);
+            p.scales.push_back(st->ParameterScale(*j));
+            p.factors.push_back(1);
+            p.types.push_back(type);
+        }
+    }
+}
+
+// converts text to type of each parameter that takes the column. Returns
+// false if text is not valid for the type. len -1 is NULL
+bool FBExport::BindText(IBPP::Statement& st, int col, const char *data, int len)
+{
+    ColumnPlan& p = Plan[col];
+    for (size_t j = 0; j < p.params.size(); j++)
+    {
+        if (len < 0)
+            st->SetNull(p.params[j]);
+        else if (!BindTextParam(st, p.params[j], p.types[j], p.scales[j], data, len))
+            return false;
+    }
+    return true;
+}
+
+// converts value given as text to parameter's type, false if it does not fit
+bool FBExport::BindTextParam(IBPP::Statement& st, int param, IBPP::SDT type,
+    int scale, const char *data, int len)
+{
+    switch (type)
+    {
+        case IBPP::sdString:
+            st->SetRaw(param, data, len);
+            break;
+        case IBPP::sdSmallint:
+        case IBPP::sdInteger:
+        case IBPP::sdLargeint:
+        {
+            int64_t value;
+            if (!parseScaled(data, len, scale, value))
+                return false;
+            setRawInteger(st, param, type, value);
+            break;
+        }
+        case IBPP::sdFloat:
+        case IBPP::sdDouble:
+        {
+            double d;
+            if (!parseDouble(data, len, d))
+                return false;
+            if (type == IBPP::sdFloat)
+            {
+                float f = (float)d;
+                st->SetRaw(param, &f, 4);
+            }
+            else if (scale)         // dialect 1 numeric, IBPP rounds it
+                st->Set(param, d);
+            else
+                st->SetRaw(param, &d, 8);
+            break;
+        }
+        case IBPP::sdDate:
+        {
+            int date;
+            if (!HumanFormat.ParseDate(data, len, date))
+                return false;
+            setRawDate(st, param, date);
+            break;
+        }
+        case IBPP::sdTime:
+        {
+            int time;
+            if (!HumanFormat.ParseTime(data, len, time))
+                return false;
+            setRawTime(st, param, time);
+            break;
+        }
+        case IBPP::sdTimestamp:
+        {
+            int date, time;
+            if (!HumanFormat.ParseTimestamp(data, len, date, time))
+                return false;
+            setRawTimestamp(st, param, date, time);
+            break;
+        }
+        case IBPP::sdBlob:
+            st->Set(param, string(data, len));
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// binds and executes records of parsed chunk, starting with record first,
+// or queues them into batch. Returns true if there were too many errors
+bool FBExport::ImportCsvChunk(IBPP::Statement& st, CsvChunk& c, size_t first,
+    ImportBatch *batch, int& ret, int& Errors, vector<string>& rowData, int& slot)
+{
+    vector<const char *> noPointers;    // rows are kept as text
+    vector<int> noLengths;
+    for (size_t r = first; r + 1 < c.records.size(); r++)
+    {
+        const char *text = c.data + c.starts[r];
+        size_t textLen = c.starts[r + 1] - c.starts[r];
+        while (textLen > 0 && (text[textLen - 1] == '\n' || text[textLen - 1] == '\r'))
+            textLen--;
+        CurrentData.assign(text, textLen);
+
+        bool ErrorInHere = false;
+        int count = (int)(c.records[r + 1] - c.records[r]);
+        if (count != fieldcount)
+        {
+            Printf("\nRecord has %d fields, header has %d.\n", count, fieldcount);
+            ErrorInHere = true;
+        }
+        for (int i=0; i<fieldcount && !ErrorInHere; i++)
+        {
+            CsvField& f = c.fields[c.records[r] + i];
+            try
+            {
+                if (!BindText(st, i, f.data, f.len))
+                {
+                    Printf("\nInvalid value of field %d: %.*s\n", i+1, f.len, f.data);
+                    ErrorInHere = true;
+                }
+            }
+            catch(IBPP::Exception &e)
+            {
+                Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                Printf("\nCurrent field: %d of %d.\n", i+1, fieldcount);
+                ErrorInHere = true;
+            }
+        }
+
+        if (!ErrorInHere && batch)
+        {
+            rowData[slot++].swap(CurrentData);
+            if (QueueRow(st, batch))
+            {
+                if (FlushBatch(st, batch, 0, ret, Errors, rowData, noPointers, noLengths))
+                    return true;
+                slot = 0;
+            }
+            continue;
+        }
+
+        if (!ErrorInHere)
+        {
+            try
+            {
+                st->Execute();
+                ret++;
+            }
+            catch (IBPP::Exception &e)
+            {
+                Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                ErrorInHere = true;
+            }
+        }
+
+        if (ErrorInHere && RowFailed(Errors))
+            return true;
+        if (!batch)
+            ImportCheckpoint(st, ret, ret - 1);
+    }
+    return false;
+}
+
+// imports CSV file (-Ic). Input is read in windows which are split into
+// chunks at record boundaries, and chunks are parsed by separate threads
+// while rows of the previous window are bound and executed
+// returns number of rows inserted, or -1 if error
+int FBExport::ImportCsv(IBPP::Statement& st, InputSource& in)
+{
+    Printf("Importing data...\n");
+    time_t StartTime;
+    time(&StartTime);
+
+    if (ar->Separator.length() != 1 || ar->Separator[0] == '"'
+        || ar->Separator[0] == '\r' || ar->Separator[0] == '\n')
+    {
+        Printf("CSV import needs a single character separator (-B).\n");
+        return -1;
+    }
+    char separator = ar->Separator[0];
+    FileVersion = FBEXPORT_FILE_VERSION_TEXT;   // failed rows are shown as text
+    FileFlags = 0;
+
+    int threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1)
+        threads = 1;
+
+    CsvReader reader(in, separator);
+    CsvWindow windows[2];
+    vector<std::thread> parsers;
+    if (!reader.Next(windows[0], threads))
+    {
+        Printf("CSV file is empty, header line with column names expected.\n");
+        return -1;
+    }
+    startParsing(windows[0], separator, parsers);
+    joinAll(parsers);
+    if (!CsvHeader(windows[0].chunks[0]))
+        return -1;
+
+    AddValuesClause();
+    BuildParamMap();
+    Printf("SQL: %s\n", ar->SQL.c_str());
+    Printf("Prepare statement...");
+    st->Prepare(ar->SQL);
+    Printf("Done.\n");
+    CompileCsvPlan(st);
+
+    ImportBatch *batch = (ar->Batch > 1 ? PrepareBatch(st) : 0);
+    vector<string> rowData(batch ? batch->capacity : 1);
+    int slot = 0;
+    int ret = 0;
+    int Errors = 0;
+    bool stop = false;
+    size_t first = 1;       // header is skipped
+    for (int cur = 0; !stop; cur = 1 - cur)
+    {
+        CsvWindow& w = windows[cur];
+        bool more = reader.Next(windows[1 - cur], threads);
+        if (more)
+            startParsing(windows[1 - cur], separator, parsers);
+
+        for (size_t k = 0; k < w.chunks.size() && !stop; k++)
+        {
+            CsvChunk& c = w.chunks[k];
+            stop = ImportCsvChunk(st, c, first, batch, ret, Errors, rowData, slot);
+            first = 0;
+            if (!stop && !c.error.empty())
+            {
+                size_t left = c.len - c.starts.back();
+                CurrentData.assign(c.data + c.starts.back(), left < 80 ? left : 80);
+                Printf("\nCSV data is malformed (%s), bailing out...\n", c.error.c_str());
+                ret = -1;
+                stop = true;
+            }
+        }
+        joinAll(parsers);
+        if (!more)
+            break;
+    }
+    if (batch && slot > 0 && !stop)     // the rest of rows
+    {
+        vector<const char *> noPointers;
+        vector<int> noLengths;
+        FlushBatch(st, batch, 0, ret, Errors, rowData, noPointers, noLengths);
+    }
+    delete batch;
+
+    time_t EndTime;
+    time(&EndTime);
+    Printf("\nStart   : %s", ctime(&StartTime));
+    Printf("End     : %s",   ctime(&EndTime));
+    Printf("Elapsed : %d seconds.\n",  (EndTime - StartTime));
+
+    return ret;
+}
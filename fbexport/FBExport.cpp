@@ -31,13 +31,11 @@
 #include <windows.h>
 #include <io.h>
 #include <fcntl.h>
-#define INT64FORMAT "%Li"
 #define atoll(x) _atoi64(x)
 #endif
 
 #ifdef IBPP_LINUX
 #define __cdecl /**/
-#define INT64FORMAT "%lli"
 #define strnicmp(a, b, c) strncasecmp( (a), (b), (c) )
 #endif
 
@@ -56,46 +54,184 @@
 #include <cstring>
 
 #include "ParseArgs.h"
+#include "TextKernels.h"
 #include "FBExport.h"
+#include "SqlScript.h"
+
+// timestamps in text fbx files: YYYYMMDDHHMMSS
+static const DateTimeFormat fileTimestamp("YMD", "HMS", "");
 
 // Converts IBPP::SDT to unsigned char (which will be written to file)
 unsigned char FBExport::SDT2uc(IBPP::SDT st)
 {
     return (unsigned char)(st);
 }
-// read blob data from database and Write to fbx file
-void FBExport::WriteBlob(FILE *fp, IBPP::Statement& st, int col)
+// writes lowest bytes of value, little-endian
+void encodeLE(char *dest, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++, value >>= 8)
+        dest[i] = (char)(value & 0xFF);
+}
+// reads 1-8 byte little-endian number, with sign
+int64_t decodeLE(const char *src, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | (unsigned char)src[i];
+    if (bytes > 0 && bytes < 8 && (src[bytes - 1] & 0x80))
+        value |= ~(uint64_t)0 << (bytes * 8);
+    return (int64_t)value;
+}
+// read blob data from database and Write to fbx file. If blob was already
+// loaded (export pipeline does that in fetch thread) data is given
+void FBExport::WriteBlob(OutputSink& out, IBPP::Row& row, int col, const string *data)
 {
     // NULL indicator: 0 = null, 1 = not null
-    if (st->IsNull(col))
+    if (row->IsNull(col))
     {
-        fputc(0, fp);
+        out.Put(0);
         return;
     }
     else
-        fputc(1, fp);
+        out.Put(1);
+
+    if (data)
+    {
+        string::size_type pos = 0;
+        int size;
+        do
+        {
+            size = (int)min(data->length() - pos, (string::size_type)8192);
+            char *segment = out.Reserve(4 + 8192);
+            for (int i = 3, x = size; i >= 0; i--, x /= 10)
+                segment[i] = (char)('0' + x % 10);
+            memcpy(segment + 4, data->data() + pos, size);
+            out.Commit(4 + size);
+            pos += size;
+        }
+        while (size > 0);
+        return;
+    }
 
-    IBPP::Blob b = IBPP::BlobFactory(st->DatabasePtr(), st->TransactionPtr());
-    st->Get(col, b);
+    IBPP::Blob b = IBPP::BlobFactory(row->DatabasePtr(), row->TransactionPtr());
+    row->Get(col, b);
     b->Open();
 
-    unsigned char buffer[8192];     // 8K block
     int size;
     do
     {
-        size = b->Read(buffer, 8192);
-        fprintf(fp, "%04d", size);          // write as ASCII number
-        if (size > 0)
-            fwrite(buffer, 1, size, fp);    // write contents to a file
+        // 8K block is read straight into output buffer, after its length
+        char *segment = out.Reserve(4 + 8192);
+        size = b->Read(segment + 4, 8192);
+        for (int i = 3, x = size; i >= 0; i--, x /= 10)
+            segment[i] = (char)('0' + x % 10);  // write as ASCII number
+        out.Commit(4 + size);
     }
     while (size > 0);
     b->Close();
 }
 
+// encodes numeric or date/time value in its native binary form (file version 190)
+// dest must have room for 8 bytes, returns number of bytes used
+int FBExport::EncodeBinary(IBPP::Row& row, int col, IBPP::SDT type, char *dest)
+{
+    int len = 0;
+    switch (type)
+    {
+        case IBPP::sdSmallint:
+        {
+            int16_t x;
+            row->Get(col, x);
+            len = 2;
+            encodeLE(dest, (uint16_t)x, len);
+            break;
+        }
+        case IBPP::sdInteger:
+        {
+            int32_t x;
+            row->Get(col, x);
+            len = 4;
+            encodeLE(dest, (uint32_t)x, len);
+            break;
+        }
+        case IBPP::sdLargeint:
+        {
+            int64_t x;
+            row->Get(col, x);
+            len = 8;
+            encodeLE(dest, (uint64_t)x, len);
+            break;
+        }
+        case IBPP::sdFloat:
+        {
+            float f;
+            uint32_t bits;
+            row->Get(col, f);
+            memcpy(&bits, &f, 4);
+            len = 4;
+            encodeLE(dest, bits, len);
+            break;
+        }
+        case IBPP::sdDouble:
+        {
+            double d;
+            uint64_t bits;
+            row->Get(col, d);
+            memcpy(&bits, &d, 8);
+            len = 8;
+            encodeLE(dest, bits, len);
+            break;
+        }
+        case IBPP::sdDate:
+        {
+            IBPP::Date d;
+            row->Get(col, d);
+            len = 4;
+            encodeLE(dest, (uint32_t)d.GetDate(), len);
+            break;
+        }
+        case IBPP::sdTime:
+        {
+            IBPP::Time t;
+            row->Get(col, t);
+            len = 4;
+            encodeLE(dest, (uint32_t)t.GetTime(), len);
+            break;
+        }
+        case IBPP::sdTimestamp:
+        {
+            IBPP::Timestamp ts;
+            row->Get(col, ts);
+            encodeLE(dest, (uint32_t)ts.GetDate(), 4);
+            encodeLE(dest + 4, (uint32_t)ts.GetTime(), 4);
+            len = 8;
+            break;
+        }
+        default:
+            Printf("\nWARNING: Datatype not supported by this version of fbexport!!!\n");
+    }
+    return len;
+}
+// writes binary value, length byte is followed by value bytes.
+// 255 is NULL, just like for strings
+void FBExport::WriteBinary(OutputSink& out, IBPP::Row& row, int col, IBPP::SDT type)
+{
+    if (row->IsNull(col))
+    {
+        out.Put(255);
+        return;
+    }
+
+    char *p = out.Reserve(9);   // length + up to 8 bytes of value
+    int len = EncodeBinary(row, col, type, p + 1);
+    p[0] = (char)len;
+    out.Commit(len + 1);
+}
+
 // Read Blob from fbx file and insert into database
-int FBExport::ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed )
+int FBExport::ReadBlob(InputSource& in, IBPP::Statement& st, int col, bool needed )
 {
-    int len = fgetc(fp);
+    int len = in.Get();
     if (len == EOF)         // blob could be the first field of a row
         return -1;          // report EOF to the calling function
 
@@ -115,18 +251,15 @@ int FBExport::ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed )
         while (true)
         {
             // read length of the next segment
-            char temp[5];
-            unsigned char buffer[8192];
-            len = fread(temp, 1, 4, fp);
-            if (len != 4)   // fatal error, something's wrong
+            const char *temp = in.View(4);
+            if (!temp)      // fatal error, something's wrong
             {
                 Printf("\nFile seems corrupt (reason 1), bailing out...\n");
                 return -2;
             }
 
             // convert ascii to number
-            temp[4] = '\0'; // terminator
-            len = (int)atol(temp);
+            len = segmentLength(temp);
             if (len < 0)
             {
                 Printf("\nFile seems corrupt (reason 2), bailing out...\n");
@@ -136,7 +269,8 @@ int FBExport::ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed )
             if (len == 0)   // end of blob data
                 break;
 
-            if ((unsigned int)len != fread(buffer, 1, len, fp))
+            const char *buffer = in.View(len);
+            if (!buffer)
             {
                 Printf("\nFile seems corrupt (reason 3), bailing out...\n");
                 return -2;
@@ -148,8 +282,9 @@ int FBExport::ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed )
         if (needed)
         {
             b->Close();
-            for (set<int>::iterator j = parmap[col].begin(); j != parmap[col].end(); j++)
-                st->Set(*j, b);
+            vector<int>& params = Plan[col-1].params;
+            for (size_t j = 0; j < params.size(); j++)
+                st->Set(params[j], b);
         }
     }
     catch (...)
@@ -160,74 +295,15 @@ int FBExport::ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed )
 
     return 0;
 }
-string FBExport::GetHumanDate(int year, int month, int day)
-{
-    string value;
-    for (string::iterator c = ar->DateFormat.begin(); c != ar->DateFormat.end(); c++)
-    {
-        int var = -1;
-        string format = "%02d";
-        switch (*c)
-        {
-            case 'd':   format = "%d";
-            case 'D':   var = day;          break;
-            case 'm':   format = "%d";
-            case 'M':   var = month;        break;
-            case 'Y':   format = "%04d";
-            case 'y':   var = year;         break;
-            default:    value += *c;
-        }
-
-        if (*c == 'y')
-            var %= 100;
-
-        if (var != -1)
-        {
-            char str[10];
-            sprintf(str, format.c_str(), var);
-            value += str;
-        }
-    }
-    return value;
-}
-string FBExport::GetHumanTime(int hour, int minute, int second)
-{
-    string value;
-    for (string::iterator c = ar->TimeFormat.begin(); c != ar->TimeFormat.end(); c++)
-    {
-        int var = -1;
-        string format = "%02d";
-        switch (*c)
-        {
-            case 'h':   format = "%d";
-            case 'H':   var = hour;         break;
-            case 'm':   format = "%d";
-            case 'M':   var = minute;       break;
-            case 's':   format = "%d";
-            case 'S':   var = second;       break;
-            default:    value += *c;
-        }
-
-        if (var != -1)
-        {
-            char str[10];
-            sprintf(str, format.c_str(), var);
-            value += str;
-        }
-    }
-    return value;
-}
-string FBExport::GetHumanTimestamp(IBPP::Timestamp ts)
+void precisionLost(int input_scale, int i, int scale)
 {
-    int year, month, day, hour, minute, second;
-    ts.GetDate(year, month, day);
-    ts.GetTime(hour, minute, second);
-
-    string value;
-    value = GetHumanTime(hour, minute, second);
-    if (value != "")
-        value = " " + value;
-    return GetHumanDate(year, month, day) + value;
+    char buff[300];
+    sprintf(buff, "Warning: precision from file (%d) is "
+        "greater than parameter %d precision (%d).\nYou might lose some "
+        "significant digits.\nPlease re-export data or use CAST.\n",
+        input_scale, i, scale);
+    DataFormatException dfe(buff);
+    throw dfe;
 }
 void reScaleInt(std::string& s, int scale, int i)
 {
@@ -240,15 +316,7 @@ void reScaleInt(std::string& s, int scale, int i)
     {
         int input_scale = (s.length() - p - 1);
         if (input_scale > scale)    // we are losing precision, warn the user
-        {
-            char buff[300];
-            sprintf(buff, "Warning: precision from file (%d) is "
-                "greater than parameter %d precision (%d).\nYou might lose some "
-                "significant digits.\nPlease re-export data or use CAST.\n",
-                input_scale, i, scale);
-            DataFormatException dfe(buff);
-            throw dfe;
-        }
+            precisionLost(input_scale, i, scale);
         needed = scale - input_scale;
         s.erase(p, 1);
     }
@@ -257,286 +325,342 @@ void reScaleInt(std::string& s, int scale, int i)
     while (needed-- > 0)
         s += "0";
 }
-void scaleInt(std::string& s, int scale)
+
+// appends data quoted and escaped as needed by export format
+void FBExport::AppendEscaped(string& dest, const char *data, size_t len,
+    bool numeric)
 {
-    if (scale == 0)
-        return;
-    bool minus = (s.length() > 0 && s[0] == '-');
-    unsigned len = (unsigned)scale;
-    if (minus)
-        len++;
-    while (s.length() <= len)
-    {
-        if (minus)
-            s.insert(1, "0");
-        else
-            s = "0" + s;
-    }
-    s.insert(s.length() - scale, ".");
+    if (ar->ExportFormat == xefCSV)         // CVS format, each field's value is quoted
+        appendQuoted(dest, data, len, '"');
+    else if (ar->ExportFormat == xefInserts && !numeric)
+        appendQuoted(dest, data, len, '\'');  // INSERTs, use single quotes for non-numeric values
+    else if (ar->ExportFormat == xefHTML && !numeric)
+        appendHtml(dest, data, len);
+    else
+        dest.append(data, len);
 }
-
-string FBExport::CreateHumanString(IBPP::Statement& st, int col)
+// sets the value to text that represents value of column "col" in human
+// readable formats. value is reused for all fields, to avoid reallocation
+void FBExport::CreateHumanString(IBPP::Row& row, int col, const string *blob,
+    string& value)
 {
-    string value;
-    if (st->IsNull(col))
-        return (ar->ExportFormat == xefInserts ? "NULL" : "");
+    value.clear();
+    if (row->IsNull(col))
+    {
+        if (ar->ExportFormat == xefInserts)
+            value = "NULL";
+        return;
+    }
 
-    char *c;                // temporary variables, declared here since declaring
-    char str[30];           // inside "switch" isn't possible
-    double dval;
-    float fval;
+    double dval;            // temporary variables, declared here since declaring
+    float fval;             // inside "switch" isn't possible
     int64_t int64val;
     int x;
     IBPP::Date d;
     IBPP::Time t;
     IBPP::Timestamp ts;
-    int year, month, day, hour, minute, second, millisec;
+    string text;
 
-    IBPP::SDT DataType = st->ColumnType(col);
+    IBPP::SDT DataType = row->ColumnType(col);
 
     if (DataType == IBPP::sdDate && Dialect == 1)
         DataType = IBPP::sdTimestamp;
 
-    value = "";
     bool numeric = false;
+    const char *data;
+    int len;
     switch (DataType)
     {
-        case IBPP::sdString:
+        case IBPP::sdString:        // escaped straight from the row buffer
+            row->GetString(col, data, len, false);
+            if (ar->TrimChars)
+                len = (int)trimmedLength(data, len);
+            AppendEscaped(value, data, len, false);
+            return;
         case IBPP::sdBlob:
-            st->Get(col, value);
+            if (!blob)
+            {
+                row->Get(col, text);
+                blob = &text;
+            }
+            len = (int)blob->length();
             if (ar->TrimChars)
-                value.erase(value.find_last_not_of(' ')+1);
-            break;
+                len = (int)trimmedLength(blob->data(), len);
+            AppendEscaped(value, blob->data(), len, false);
+            return;
+
+        // numbers, dates and times are formatted in place
         case IBPP::sdInteger:
         case IBPP::sdSmallint:
-            st->Get(col, &x);
-            sprintf(str, "%ld", x);
-            value = str;
+            row->Get(col, x);
+            appendScaled(value, x, row->ColumnScale(col));
             numeric = true;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
-            break;
-        case IBPP::sdDate:
-            st->Get(col, d);
-            if (IBPP::dtoi(d.GetDate(), &year, &month, &day))
-                value = GetHumanDate(year, month, day);
-            break;
-        case IBPP::sdTime:
-            st->Get(col, t);
-            IBPP::ttoi(t.GetTime(), &hour, &minute, &second, &millisec);
-            value = GetHumanTime(hour, minute, second);
-            break;
-        case IBPP::sdTimestamp:
-            st->Get(col, ts);
-            value = GetHumanTimestamp(ts);
             break;
         case IBPP::sdFloat:
-            st->Get(col, &fval);            
-            snprintf(str,30,"%19g",fval);
-            value = str;
+            row->Get(col, fval);
+            appendFloat(value, fval);
             numeric = true;
             break;
         case IBPP::sdDouble:
-            st->Get(col, &dval);            
-            snprintf(str,30,"%19g",dval);
-            value = str;
+            row->Get(col, dval);
+            appendDouble(value, dval);
             numeric = true;
             break;
         case IBPP::sdLargeint:
-            st->Get(col, &int64val);
-            sprintf(str, INT64FORMAT, int64val);
-            value = str;
+            row->Get(col, int64val);
+            appendScaled(value, int64val, row->ColumnScale(col));
             numeric = true;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
+            break;
+        case IBPP::sdDate:
+            row->Get(col, d);
+            HumanFormat.AppendDate(value, d.GetDate());
+            break;
+        case IBPP::sdTime:
+            row->Get(col, t);
+            HumanFormat.AppendTime(value, t.GetTime());
+            break;
+        case IBPP::sdTimestamp:
+            row->Get(col, ts);
+            HumanFormat.AppendTimestamp(value, ts.GetDate(), ts.GetTime());
             break;
 
         default:
             Printf("\nWARNING: Datatype not supported!!\n");
     };
 
-    if (ar->ExportFormat == xefCSV)         // CVS format, each field's value is quoted
+    // only -J and -K formats can bring in characters that need escaping
+    const char *special = "";
+    if (ar->ExportFormat == xefCSV)
+        special = "\"";
+    else if (ar->ExportFormat == xefInserts && !numeric)
+        special = "'";
+    else if (ar->ExportFormat == xefHTML && !numeric)
+        special = "&<>\"";
+    if (*special && findAny(value.data(), value.length(), special) < value.length())
     {
-        // escape quotes with two quotes " => ""
-        string::size_type pos = string::npos;
-        while (true)
-        {
-            pos = value.find_last_of('"', pos);
-            if (pos == string::npos)
-                break;
-            value.insert(pos, 1, '"');
-            if (pos == 0)
-                break;
-            pos--;
-        }
-        value = "\"" + value + "\"";        // except those which are NULL
+        text.swap(value);
+        AppendEscaped(value, text.data(), text.length(), numeric);
     }
-
-    if (ar->ExportFormat == xefInserts && !numeric)
+    else if (ar->ExportFormat == xefCSV || *special == '\'')
     {
-        string::size_type pos = string::npos;
-        while (true)
-        {
-            pos = value.find_last_of('\'', pos);
-            if (pos == string::npos)
-                break;
-            value.insert(pos, 1, '\'');
-            if (pos == 0)
-                break;
-            pos--;
-        }
-        value = "'" + value + "'";      // INSERTs, use single quotes for non-numeric values
+        value.insert(0, 1, *special);
+        value += *special;
     }
-
-    return value;
 }
 // sets the value to string that represents value of column "col"
 // returns false is value is null, true otherwise
-bool FBExport::CreateString(IBPP::Statement& st, int col, string &value)
+bool FBExport::CreateString(IBPP::Row& row, int col, string &value)
 {
-    if (st->IsNull(col))
+    if (row->IsNull(col))
         return false;
 
-    char *c;                // temporary variables, declared here since declaring
-    char str[30];           // inside "switch" isn't possible
-    double dval;
-    float fval;
+    double dval;            // temporary variables, declared here since declaring
+    float fval;             // inside "switch" isn't possible
     int64_t int64val;
     int x;
     IBPP::Date d;
     IBPP::Time t;
     IBPP::Timestamp ts;
-    int year, month, day, hour, minute, second;
 
-    IBPP::SDT DataType = st->ColumnType(col);
+    IBPP::SDT DataType = row->ColumnType(col);
     if (DataType == IBPP::sdDate && Dialect == 1)
         DataType = IBPP::sdTimestamp;
 
+    const char *data;
+    int len;
+    value.clear();
     switch (DataType)
     {
         case IBPP::sdString:
-            st->Get(col, value);
-            if (ar->TrimChars)
-                value.erase(value.find_last_not_of(' ')+1);
+            row->GetString(col, data, len, ar->TrimChars);
+            value.assign(data, len);
             return true;
         case IBPP::sdInteger:
         case IBPP::sdSmallint:
-            st->Get(col, &x);
-            sprintf(str, "%ld", x);
-            value = str;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
+            row->Get(col, x);
+            appendScaled(value, x, row->ColumnScale(col));
             return true;
         case IBPP::sdDate:
-            st->Get(col, d);
-            sprintf(str, "%ld", d.GetDate());
-            value = str;
+            row->Get(col, d);
+            appendInt(value, d.GetDate());
             return true;
         case IBPP::sdTime:
-            st->Get(col, t);
-            sprintf(str, "%ld", t.GetTime());
-            value = str;
+            row->Get(col, t);
+            appendInt(value, t.GetTime());
             return true;
         case IBPP::sdTimestamp:
-            st->Get(col, ts);
-            ts.GetDate(year, month, day);
-            ts.GetTime(hour, minute, second);
-            sprintf(str, "%04d%02d%02d%02d%02d%02d", year, month, day, hour, minute, second);
-            value = str;
+            row->Get(col, ts);
+            fileTimestamp.AppendTimestamp(value, ts.GetDate(), ts.GetTime());
             return true;
         case IBPP::sdFloat:
-            st->Get(col, &fval);
-            snprintf(str,30,"%19g",fval);
-            value = str;
+            row->Get(col, fval);
+            appendFloat(value, fval);
             return true;
         case IBPP::sdDouble:
-            st->Get(col, &dval);            
-            snprintf(str,30,"%19g",dval);
-            value = str;
+            row->Get(col, dval);
+            appendDouble(value, dval);
             return true;
         case IBPP::sdLargeint:
-            st->Get(col, &int64val);
-            sprintf(str, INT64FORMAT, int64val);
-            value = str;
-            scaleInt(value, st->ColumnScale(col));   // scaled integer
+            row->Get(col, int64val);
+            appendScaled(value, int64val, row->ColumnScale(col));
             return true;
 
         default:
             Printf("\nWARNING: Datatype not supported by this version of fbexport!!!\n");
-            value = "";
     };
 
     return true;
 }
-// statement is prepared, just need to fetch all into file
-// returns: # of rows exported, -1 on error
-int FBExport::Export(IBPP::Statement& st, FILE *fp)
+// writes file header: version, number of fields and fields' data types
+// version 190 also has a flags byte and scales of all fields
+void FBExport::ExportHeader(IBPP::Statement& st, OutputSink& out)
 {
-    Printf("Exporting data...\n");
-    time_t StartTime;
-    time(&StartTime);
-
-    // file header
-    fputc(0, fp);
-    fputc(FBEXPORT_FILE_VERSION, fp);   // fbexport version
+    out.Put(0);
+    out.Put((unsigned char)FileVersion);   // fbexport version
+    if (FileVersion >= FBEXPORT_FILE_VERSION)
+        out.Put((unsigned char)FileFlags);
 
     int fc = st->Columns();
-
-    // writes number of fields and fields' data types
-    fputc((unsigned char)(fc), fp);
+    out.Put((unsigned char)(fc));
     for (int i=1; i<=fc; i++)
     {
         IBPP::SDT DataType = st->ColumnType(i);
         if (DataType == IBPP::sdDate && Dialect == 1)
             DataType = IBPP::sdTimestamp;
 
-        fputc(SDT2uc(DataType), fp);
+        out.Put(SDT2uc(DataType));
     }
+    if (FileVersion >= FBEXPORT_FILE_VERSION)
+        for (int i=1; i<=fc; i++)
+            out.Put((unsigned char)st->ColumnScale(i));
 
-    int ret=0;
-    // loop through all records in dataset, and ...
-    while (st->Fetch())
+    if (FileFlags & FBX_FLAG_COMPRESSED)
+        out.SetCompression(ar->Compress);
+}
+// data type of each column as stored in fbx file, types[0] is not used
+void FBExport::FileTypes(IBPP::Statement& st, vector<IBPP::SDT>& types)
+{
+    int fc = st->Columns();
+    types.resize(fc + 1);
+    for (int i=1; i<=fc; i++)
     {
-        CurrentData = "";
-        for (int i=1; i<=fc; i++)   // ... export all fields to file.
+        types[i] = st->ColumnType(i);
+        if (types[i] == IBPP::sdDate && Dialect == 1)
+            types[i] = IBPP::sdTimestamp;
+    }
+}
+// encodes all fields of a row into output buffer. value is just reused, to
+// avoid reallocation for each field. blobs are contents of blob columns
+// loaded by the fetch thread of export pipeline (0 = read them here)
+void FBExport::EncodeRow(OutputSink& out, IBPP::Row& row, vector<IBPP::SDT>& types,
+    string& value, const string *blobs)
+{
+    bool binary = (FileVersion >= FBEXPORT_FILE_VERSION);
+    for (size_t i=1; i<types.size(); i++)
+    {
+        // if it's a BLOB, use different technique (since BLOBs can be really big!)
+        if (types[i] == IBPP::sdBlob)
+            WriteBlob(out, row, i, blobs ? &blobs[i] : 0);
+        else if (binary && types[i] != IBPP::sdString)
+            WriteBinary(out, row, i, types[i]);
+        else
         {
-            // if it's a BLOB, use different technique (since BLOBs can be really big!)
-            if (st->ColumnType(i) == IBPP::sdBlob)
-                WriteBlob(fp, st, i);
+            const char *data;
+            int vallen;
+            bool is_null;
+            if (types[i] == IBPP::sdString)     // no copy, points into the row
+                is_null = row->GetString(i, data, vallen, ar->TrimChars);
             else
             {
                 // creates string representation of a field
-                string value;
-                bool is_null = !CreateString(st, i, value);
-                unsigned int vallen = value.length();
-                int len = (is_null ? 255 : vallen);
-
-                // up to 253 chars for single byte marker, if value = 254, it's a multibyte
-                // if value = 255, it's a null value
-                if (vallen > 253)
-                    len = 254;  // special marker
-
-                // writes the length of it.
-                if (fputc((unsigned char)len, fp) == EOF)
-                {
-                    Printf("Cannot write file: %s.\n", ar->Filename.c_str());
-                    return -1;
-                }
-
-                if (len == 254) // real length is > 253
-                {
-                    fputc((unsigned char)(vallen / 256), fp);
-                    fputc((unsigned char)(vallen % 256), fp);
-                }
+                is_null = !CreateString(row, i, value);
+                data = value.data();
+                vallen = value.length();
+            }
 
-                // writes it if it's not a NULL value
-                if (!is_null)
-                    fprintf(fp, "%s", value.c_str());
+            // up to 253 chars for single byte marker, if value = 254, it's a multibyte
+            // if value = 255, it's a null value
+            int len = vallen;
+            if (is_null)
+                len = 255;
+            else if (vallen > 253)
+                len = 254;  // special marker
+
+            // writes the length of it.
+            out.Put((unsigned char)len);
+            if (len == 254) // real length is > 253
+            {
+                out.Put((unsigned char)(vallen / 256));
+                out.Put((unsigned char)(vallen % 256));
             }
+
+            // writes it if it's not a NULL value
+            if (!is_null)
+                out.Write(data, vallen);
+        }
+    }
+}
+// statement is executed, fetch all rows into output
+// worker is the number of parallel worker (0 if there is only one)
+// returns: # of rows exported, -1 on error
+int FBExport::ExportRows(IBPP::Statement& st, OutputSink& out, int worker)
+{
+    if (FileFlags & FBX_FLAG_COLUMNAR)
+        return ExportBlocks(st, out, worker);
+
+    int ret=0;
+    string value;
+    vector<IBPP::SDT> types;
+    FileTypes(st, types);
+
+    // loop through all records in dataset, and encode them
+    IBPP::Row row = st->CurrentRow();
+    while (st->Fetch())
+    {
+        EncodeRow(out, row, types, value, 0);
+        out.EndRow();
+
+        // buffer is flushed in big blocks, so we only check once per row
+        if (out.Failed())
+        {
+            Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+            return -1;
         }
 
         // print a checkpoint (exporting, no commit needed)
         if (ret % ar->CheckPoint == 0 && ret)
-            Printf("Checkpoint at: %d lines.\n", ret);
+        {
+            if (worker)
+                Printf("Worker %d checkpoint at: %d lines.\n", worker, ret);
+            else
+                Printf("Checkpoint at: %d lines.\n", ret);
+        }
         ret++;
     }
+    return ret;
+}
+// statement is prepared, just need to fetch all into file
+// returns: # of rows exported, -1 on error
+int FBExport::Export(IBPP::Statement& st, OutputSink& out)
+{
+    Printf("Exporting data...\n");
+    time_t StartTime;
+    time(&StartTime);
+
+    ExportHeader(st, out);
+    int ret;
+    if (ar->Encoders > 0 && !(FileFlags & FBX_FLAG_COLUMNAR))
+        ret = ExportPipeline(st, out, false);
+    else
+        ret = ExportRows(st, out, 0);
+    if (ret < 0)
+        return -1;
+
+    if (!out.Flush())
+    {
+        Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+        return -1;
+    }
 
     time_t EndTime;
     time(&EndTime);
@@ -545,13 +669,9 @@ int FBExport::Export(IBPP::Statement& st, FILE *fp)
     Printf("Elapsed : %d seconds.\n",  (EndTime - StartTime));
     return ret;
 }
-// binds string value to ibpp statement parameter
-// ft variable is used to track datatype
-// i  is the index of parameter
-void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT ft)
+// throws if type of data in file does not match parameter i
+void FBExport::CheckParamType(IBPP::Statement& st, int i, IBPP::SDT ft)
 {
-    //Printf("Setting parameter: %d\n", i);
-
     std::string types[] = {
         "Array", "Blob", "Date", "Time", "Timestamp", "String",
         "16bit", "32bit", "64bit", "Float", "Double" };
@@ -564,6 +684,15 @@ void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT f
         DataFormatException dfe(buff);
         throw dfe;
     }
+}
+// binds string value to ibpp statement parameter
+// ft variable is used to track datatype
+// i  is the index of parameter
+// scale is the scale of parameter, type is checked by CompilePlan()
+void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT ft,
+    int scale)
+{
+    //Printf("Setting parameter: %d\n", i);
 
     switch (ft)
     {
@@ -573,7 +702,7 @@ void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT f
         case IBPP::sdInteger:
         case IBPP::sdSmallint:
         {
-            reScaleInt(src, st->ParameterScale(i), i);
+            reScaleInt(src, scale, i);
             int x = atol(src.c_str());
             st->Set(i, x);
             break;
@@ -616,7 +745,7 @@ void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT f
         }
         case IBPP::sdLargeint:
         {
-            reScaleInt(src, st->ParameterScale(i), i);
+            reScaleInt(src, scale, i);
             int64_t int64val = atoll(src.c_str());
             st->Set(i, int64val);
             break;
@@ -628,11 +757,213 @@ void FBExport::StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT f
     }
 
 }
+
+#define ISC_DATE_SHIFT 15019     // native date is IBPP::Date + this, see ibpp/time.cpp
+
+int64_t scaleInteger(int64_t value, int64_t factor)
+{
+    if (factor != 1 && (value > INT64_MAX / factor || value < INT64_MIN / factor))
+        throw DataFormatException("Value is too big for scale of parameter.\n");
+    return value * factor;
+}
+// Values from file are copied to parameters in their native form, so IBPP
+// does not convert and check them again. Only SMALLINT and INTEGER values
+// that do not fit are left to IBPP::Set(), which reports them
+void setRawInteger(IBPP::Statement& st, int param, IBPP::SDT type, int64_t value)
+{
+    if (type == IBPP::sdSmallint && value == (int16_t)value)
+    {
+        int16_t x = (int16_t)value;
+        st->SetRaw(param, &x, 2);
+    }
+    else if (type == IBPP::sdInteger && value == (int32_t)value)
+    {
+        int32_t x = (int32_t)value;
+        st->SetRaw(param, &x, 4);
+    }
+    else if (type == IBPP::sdLargeint)
+        st->SetRaw(param, &value, 8);
+    else
+        st->Set(param, value);
+}
+void setRawDate(IBPP::Statement& st, int param, int date)
+{
+    int32_t x = date + ISC_DATE_SHIFT;
+    st->SetRaw(param, &x, 4);
+}
+void setRawTime(IBPP::Statement& st, int param, int time)
+{
+    uint32_t x = (uint32_t)time;
+    st->SetRaw(param, &x, 4);
+}
+void setRawTimestamp(IBPP::Statement& st, int param, int date, int time)
+{
+    int32_t x[2] = { date + ISC_DATE_SHIFT, time };    // ISC_TIMESTAMP
+    st->SetRaw(param, x, 8);
+}
+// values are read straight from the (possibly mapped) file, so a wrong
+// length must not make them read past it
+void checkBinarySize(int size, int minimum, int maximum)
+{
+    if (size < minimum || size > maximum)
+        throw DataFormatException("File seems corrupt (invalid length of binary value).\n");
+}
+// binders for values stored in binary form (file version 190), one for
+// each type. CompilePlan() picks them once, and checks types and scales.
+void bindString(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    st->SetRaw(param, src, size);
+}
+void bindSmallint(IBPP::Statement& st, int param, const char *src, int size,
+    int64_t factor)
+{
+    checkBinarySize(size, 1, 2);
+    setRawInteger(st, param, IBPP::sdSmallint, scaleInteger(decodeLE(src, size), factor));
+}
+void bindInteger(IBPP::Statement& st, int param, const char *src, int size,
+    int64_t factor)
+{
+    checkBinarySize(size, 1, 4);
+    setRawInteger(st, param, IBPP::sdInteger, scaleInteger(decodeLE(src, size), factor));
+}
+void bindLargeint(IBPP::Statement& st, int param, const char *src, int size,
+    int64_t factor)
+{
+    checkBinarySize(size, 1, 8);
+    setRawInteger(st, param, IBPP::sdLargeint, scaleInteger(decodeLE(src, size), factor));
+}
+void bindDate(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    checkBinarySize(size, 4, 4);
+    setRawDate(st, param, (int)decodeLE(src, 4));
+}
+void bindTime(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    checkBinarySize(size, 4, 4);
+    setRawTime(st, param, (int)decodeLE(src, 4));
+}
+void bindTimestamp(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    checkBinarySize(size, 8, 8);
+    setRawTimestamp(st, param, (int)decodeLE(src, 4), (int)decodeLE(src + 4, 4));
+}
+void bindFloat(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    checkBinarySize(size, 4, 4);
+    uint32_t bits = (uint32_t)decodeLE(src, 4);
+    float f;
+    memcpy(&f, &bits, 4);
+    st->SetRaw(param, &f, 4);
+}
+void bindDouble(IBPP::Statement& st, int param, const char *src, int size, int64_t)
+{
+    checkBinarySize(size, 8, 8);
+    uint64_t bits = (uint64_t)decodeLE(src, 8);
+    double d;
+    memcpy(&d, &bits, 8);
+    st->SetRaw(param, &d, 8);
+}
+// Builds Plan: for each column of file, the parameters that take its value
+// and how it is decoded. Types of parameters are checked here, and so are
+// the scales for binary files, so that rows are just bound by the plan
+void FBExport::CompilePlan(IBPP::Statement& st, IBPP::SDT *ft)
+{
+    bool binary = (FileVersion >= FBEXPORT_FILE_VERSION);
+    Plan.assign(fieldcount, ColumnPlan());
+    for (int i=0; i<fieldcount; i++)
+    {
+        ColumnPlan& p = Plan[i];
+        bool integer = false;
+        switch (ft[i])
+        {
+            case IBPP::sdString:    p.bind = bindString;    break;
+            case IBPP::sdSmallint:  p.bind = bindSmallint;  integer = true;  break;
+            case IBPP::sdInteger:   p.bind = bindInteger;   integer = true;  break;
+            case IBPP::sdLargeint:  p.bind = bindLargeint;  integer = true;  break;
+            case IBPP::sdDate:      p.bind = bindDate;      break;
+            case IBPP::sdTime:      p.bind = bindTime;      break;
+            case IBPP::sdTimestamp: p.bind = bindTimestamp; break;
+            case IBPP::sdFloat:     p.bind = bindFloat;     break;
+            case IBPP::sdDouble:    p.bind = bindDouble;    break;
+            default:                p.bind = 0;             break;
+        }
+
+        ParamMap::iterator it = parmap.find(i+1);
+        if (it == parmap.end())
+            continue;
+        for (set<int>::iterator j = it->second.begin(); j != it->second.end(); ++j)
+        {
+            CheckParamType(st, *j, ft[i]);
+            int scale = st->ParameterScale(*j);
+            int64_t factor = 1;
+            if (binary && integer)
+            {
+                if (FileScales[i] > scale)  // we are losing precision, warn the user
+                    precisionLost(FileScales[i], *j, scale);
+                for (int s = FileScales[i]; s < scale; s++)
+                    factor *= 10;
+            }
+            p.params.push_back(*j);
+            p.scales.push_back(scale);
+            p.factors.push_back(factor);
+            p.types.push_back(ft[i]);
+        }
+        if (binary && !p.bind && ft[i] != IBPP::sdBlob)
+            Printf("\nWARNING! Unsupported datatype of column %d... value set to NULL\n", i+1);
+    }
+}
+// readable form of binary value, only used to report the rows that failed
+string FBExport::BinaryToString(const char *src, int size, IBPP::SDT ft, int scale)
+{
+    string value;
+    switch (ft)
+    {
+        case IBPP::sdString:
+            value.assign(src, size);
+            break;
+        case IBPP::sdSmallint:
+        case IBPP::sdInteger:
+        case IBPP::sdLargeint:
+            checkBinarySize(size, 1, ft == IBPP::sdSmallint ? 2 : (ft == IBPP::sdInteger ? 4 : 8));
+            appendScaled(value, decodeLE(src, size), scale);
+            break;
+        case IBPP::sdDate:
+        case IBPP::sdTime:
+            checkBinarySize(size, 4, 4);
+            appendInt(value, (int)decodeLE(src, 4));
+            break;
+        case IBPP::sdTimestamp:
+            checkBinarySize(size, 8, 8);
+            fileTimestamp.AppendTimestamp(value, (int)decodeLE(src, 4),
+                (int)decodeLE(src + 4, 4));
+            break;
+        case IBPP::sdFloat:
+        {
+            checkBinarySize(size, 4, 4);
+            uint32_t bits = (uint32_t)decodeLE(src, 4);
+            float f;
+            memcpy(&f, &bits, 4);
+            appendFloat(value, f);
+            break;
+        }
+        case IBPP::sdDouble:
+        {
+            checkBinarySize(size, 8, 8);
+            uint64_t bits = (uint64_t)decodeLE(src, 8);
+            double d;
+            memcpy(&d, &bits, 8);
+            appendDouble(value, d);
+            break;
+        }
+        default:
+            break;
+    }
+    return value;
+}
 // imports data from "file" into database using ibpp statement "st", and "sql" insert statement
 // returns number of rows inserted, or -1 if error
-int FBExport::Import(IBPP::Statement& st, FILE *fp)
+int FBExport::Import(IBPP::Statement& st, InputSource& in)
 {
-    int Errors = 0;
     Printf("Importing data...\n");
     time_t StartTime;
     time(&StartTime);
@@ -647,38 +978,122 @@ int FBExport::Import(IBPP::Statement& st, FILE *fp)
     IBPP::SDT *ft;
     ft = new IBPP::SDT[fieldcount];
     for (int i=0; i<fieldcount; i++)
-        ft[i] = (IBPP::SDT)(fgetc(fp));
+        ft[i] = (IBPP::SDT)(in.Get());
+
+    // version 190 stores numbers and dates in binary form, scale is in header
+    FileScales.assign(fieldcount, 0);
+    if (FileVersion >= FBEXPORT_FILE_VERSION)
+    {
+        for (int i=0; i<fieldcount; i++)
+        {
+            FileScales[i] = in.Get();
+            if (FileScales[i] < 0 || FileScales[i] > 18)    // EOF or garbage
+            {
+                delete[] ft;
+                throw DataFormatException("File seems corrupt (invalid scale of column).\n");
+            }
+        }
+    }
+
+    if (FileFlags & FBX_FLAG_COMPRESSED)
+        in.StartDecompression();
+
+    CompilePlan(st, ft);
+    int ret = -2;
+    if (ar->Workers > 1)
+        ret = ImportParallel(st, in, ft);
+    if (ret == -2)      // single connection
+    {
+        ImportBatch *batch = (ar->Batch > 1 ? PrepareBatch(st) : 0);
+        if (FileFlags & FBX_FLAG_COLUMNAR)
+            ret = ImportBlocks(st, in, ft, batch);
+        else
+            ret = ImportPipeline(st, in, ft, batch);
+        delete batch;
+    }
+    if (in.Failed())
+    {
+        Printf("\nFile seems corrupt (compressed data), bailing out...\n");
+        ret = -1;
+    }
+
+    // free Field Types array
+    delete[] ft;
+
+    time_t EndTime;
+    time(&EndTime);
+    Printf("\nStart   : %s", ctime(&StartTime));
+    Printf("End     : %s",   ctime(&EndTime));
+    Printf("Elapsed : %d seconds.\n",  (EndTime - StartTime));
+
+    return ret;
+}
+// sets CurrentData to values of a row of version 190 file, lengths are -1
+// for NULLs
+void FBExport::BinaryRowData(IBPP::SDT *ft, const char **values, const int *lengths)
+{
+    CurrentData = "";
+    for (int i=0; i<fieldcount; i++)
+    {
+        if (i)
+            CurrentData += ",";
+        if (ft[i] == IBPP::sdBlob)
+            continue;
+        if (lengths[i] < 0)
+            CurrentData += "[null]";
+        else
+            CurrentData += BinaryToString(values[i], lengths[i], ft[i], FileScales[i]);
+    }
+}
+// reads rows from file (row layout), binds and executes each one, or
+// queues them into batch if it is given
+// returns number of rows inserted, or -1 if error
+int FBExport::ImportRows(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+    ImportBatch *batch)
+{
+    int Errors = 0;
+    bool binary = (FileVersion >= FBEXPORT_FILE_VERSION);
+    bool mapped = in.Mapped();
+
+    // values of rows, only kept to show the row if it fails. There is one
+    // slot for each row of the batch
+    int slots = (batch ? batch->capacity : 1);
+    vector<string> rowData(slots);              // binary values, or CurrentData
+    vector<int> fieldAt(fieldcount);            // of value in rowData
+    vector<int> fieldLen(slots * fieldcount);
+    vector<const char *> fieldPtr(slots * fieldcount);
+    int slot = 0;
 
     // load data
     int ret = 0;    // number of rows entered - counter
-    while (!feof(fp))
+    bool stop = false;
+    while (!in.Eof() && !stop)
     {
         bool ErrorInHere = false;
         int size;           // size of value in bytes
-        char buff[65536];     // buffer to load data from file
         CurrentData = "";
+        rowData[slot].erase();
+        int base = slot * fieldcount;
 
         for (int i=0; i<fieldcount; i++)    // load each field value...
         {
-            bool need_this_field =  (parmap.end() != parmap.find(i+1));
+            bool need_this_field = !Plan[i].params.empty();
             if (ft[i] == IBPP::sdBlob)
             {
-                int result = ReadBlob(fp, st, i+1, need_this_field);    // try...catch..etc
+                fieldLen[base + i] = -1;
+                int result = ReadBlob(in, st, i+1, need_this_field);    // try...catch..etc
                 if (result == -1)       // EOF detected (important if the first column's type is Blob)
                 {
                     size = EOF;
                     break;
                 }
                 else if (result == -2)  // Blob errors are fatal
-                {                       // since we don't know where to continue reading the file
-                    delete[] ft;
-                    return -1;
-                }
+                    return -1;          // since we don't know where to continue reading the file
             }
             else
             {
                 bool is_null = false;
-                size = fgetc(fp);
+                size = in.Get();
 
                 if (size == EOF)    // only breaks "for" loop - see other check
                     break;          // again - just after the "for" loop
@@ -688,35 +1103,50 @@ int FBExport::Import(IBPP::Statement& st, FILE *fp)
 
                 if (size == 254)    // size > 253, read it
                 {
-                    int first = fgetc(fp);
-                    int second = fgetc(fp);
-                    size = first * 256 + second;
+                    int first = in.Get();
+                    int second = in.Get();
+                    size = first * 256 + second;
+                }
+
+                const char *value = 0;  // points into file buffer or mapping
+                if (!is_null && (value = in.View(size)) == 0)
+                {
+                    Printf("\nFile seems corrupt (reason 5), bailing out...\n");
+                    return -1;
                 }
 
-                if (!is_null)
-                    fread(buff, size, 1, fp);
+                if (binary)         // CurrentData is only built if row fails
+                {
+                    fieldLen[base + i] = (is_null ? -1 : size);
+                    fieldPtr[base + i] = value;
+                    fieldAt[i] = rowData[slot].length();
+                    if (!mapped && !is_null)
+                        rowData[slot].append(value, size);
+                }
 
                 if (ErrorInHere)    // make sure it reads the whole row
                     continue;       // version 1.0 had this bug.
 
                 string S;
-                if (!is_null)
+                if (!binary)
                 {
-                    buff[size] = '\0';
-                    S = buff;
-                }
-                else
-                    S = "[null]";
+                    if (!is_null)
+                        S.assign(value, size);
+                    else
+                        S = "[null]";
 
-                if (i)
-                    CurrentData += ",";
-                CurrentData += S;
+                    if (i)
+                        CurrentData += ",";
+                    CurrentData += S;
+                }
 
                 try
                 {
                     if (need_this_field) // we need this field data
                     {
-                        if (!is_null)
+                        if (!is_null && binary)
+                            BinaryToNumParams(value, size, st, i+1);
+                        else if (!is_null)
                         {
                             #pragma warn -sig           // to aviod Warning: conversion may lose significant digits
                             StringToNumParams(S, st, i+1, ft[i]);       // ... and assign it to params
@@ -724,8 +1154,9 @@ int FBExport::Import(IBPP::Statement& st, FILE *fp)
                         }
                         else
                         {
-                            for (set<int>::iterator j = parmap[i+1].begin(); j != parmap[i+1].end(); j++)
-                                st->SetNull(*j);
+                            vector<int>& params = Plan[i].params;
+                            for (size_t j = 0; j < params.size(); j++)
+                                st->SetNull(params[j]);
                         }
                     }
                     //else
@@ -743,6 +1174,26 @@ int FBExport::Import(IBPP::Statement& st, FILE *fp)
         if (size == EOF)    // if break was signaled inside for loop (above)
             break;          // see comments above
 
+        if (binary && !mapped)  // values were copied, buffer is reused
+        {
+            for (int i=0; i<fieldcount; i++)
+                if (fieldLen[base + i] >= 0)
+                    fieldPtr[base + i] = rowData[slot].data() + fieldAt[i];
+        }
+
+        if (!ErrorInHere && batch)
+        {
+            if (!binary)
+                rowData[slot].swap(CurrentData);
+            slot++;
+            if (QueueRow(st, batch))
+            {
+                stop = FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen);
+                slot = 0;
+            }
+            continue;
+        }
+
         if (!ErrorInHere)
         {
             try
@@ -759,44 +1210,179 @@ int FBExport::Import(IBPP::Statement& st, FILE *fp)
 
         if (ErrorInHere)
         {
-            WereErrors = true;
-            if (ar->Operation == xopInsert
-                            || ar->Operation == xopInsertFull ) // dump data if insert failed
-                Printf("Data: %s\n", CurrentData.c_str());
-
-            // output error
-            if (ar->IgnoreErrors > -1 && ++Errors > ar->IgnoreErrors)
+            if (binary)
+                BinaryRowData(ft, &fieldPtr[base], &fieldLen[base]);
+            if (RowFailed(Errors))
                 break;
         }
 
-        // print checkpoint at each "ar->Checkpoint" lines
-        if (ret % ar->CheckPoint == 0 && ret)
+        if (!batch)
+            ImportCheckpoint(st, ret, ret - 1);
+    }
+
+    if (batch && slot > 0 && !stop)     // the rest of rows
+        FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen);
+    return ret;
+}
+// executes rows queued in batch, rows that failed are reported as if they
+// were executed one by one. Returns true if there were too many errors
+bool FBExport::FlushBatch(IBPP::Statement& st, ImportBatch *batch, IBPP::SDT *ft,
+    int& ret, int& Errors, vector<string>& rowData,
+    vector<const char *>& fieldPtr, vector<int>& fieldLen)
+{
+    bool binary = (FileVersion >= FBEXPORT_FILE_VERSION);
+    vector<int> failed;
+    int before = ret;
+    ret += ExecuteBatch(st, batch, failed);
+    for (size_t f = 0; f < failed.size(); f++)
+    {
+        int slot = failed[f];
+        if (binary)
+            BinaryRowData(ft, &fieldPtr[slot * fieldcount], &fieldLen[slot * fieldcount]);
+        else
+            CurrentData = rowData[slot];
+        if (RowFailed(Errors))
+            return true;
+    }
+    ImportCheckpoint(st, ret, before);
+    return false;
+}
+// import of a row failed, returns true if there were too many errors
+bool FBExport::RowFailed(int& Errors)
+{
+    WereErrors = true;
+    if (ar->Operation == xopInsert
+                    || ar->Operation == xopInsertFull ) // dump data if insert failed
+    {
+        if (Worker)
+            Printf("Worker %d data: %s\n", Worker, CurrentData.c_str());
+        else
+            Printf("Data: %s\n", CurrentData.c_str());
+    }
+
+    // -E limit is for all threads of parallel import together
+    int count = (SharedErrors ? ++*SharedErrors : ++Errors);
+    return (ar->IgnoreErrors > -1 && count > ar->IgnoreErrors);
+}
+// add values clause to insert statement, only if op = 'I'
+void FBExport::AddValuesClause()
+{
+    if (ar->Operation != xopInsert)
+        return;
+    ar->SQL += " VALUES (";
+    char num[10];
+    for (int i=0; i<fieldcount; i++)
+    {
+        if (i)
+            ar->SQL += ",";
+        sprintf(num, "%d", i+1);
+        ar->SQL += ":" + (string)num;
+    }
+    ar->SQL += ")";
+}
+// table that import goes into: the one from -V, or the one after INTO in
+// -Q statement. Empty if not found
+string FBExport::ImportTable()
+{
+    if (ar->VerbatimCopyTable != "")
+        return ar->VerbatimCopyTable;
+    return insertTable(ar->SQL);
+}
+
+string insertTable(const string& sql)
+{
+    string::size_type p = 0;
+    while (true)
+    {
+        p = sql.find_first_of("iI", p);
+        if (p == string::npos)
+            return "";
+        if ((p == 0 || isspace((unsigned char)sql[p-1])) && p + 4 < sql.length()
+            && strnicmp(sql.c_str() + p, "INTO", 4) == 0
+            && isspace((unsigned char)sql[p+4]))
         {
-            Printf("Checkpoint at: %d lines.", ret);
-            if (ar->CommitOnCheckpoint)
-            {
-                IBPP::Transaction t = st->TransactionPtr();
-                if (t.intf())
-                {
-                    t->Commit();
-                    Printf(" Transaction commited.");
-                    t->Start();     // start new transaction
-                }
-            }
-            Printf("\n");
+            break;
         }
+        p++;
     }
 
-    // free Field Types array
-    delete[] ft;
-
-    time_t EndTime;
-    time(&EndTime);
-    Printf("\nStart   : %s", ctime(&StartTime));
-    Printf("End     : %s",   ctime(&EndTime));
-    Printf("Elapsed : %d seconds.\n",  (EndTime - StartTime));
+    p = sql.find_first_not_of(" \t\r\n", p + 4);
+    if (p == string::npos)
+        return "";
+    string table;
+    if (sql[p] == '"')
+    {
+        string::size_type q = sql.find('"', p + 1);
+        if (q != string::npos)
+            table = sql.substr(p + 1, q - p - 1);
+        return table;
+    }
+    for (; p < sql.length() && (isalnum((unsigned char)sql[p]) || sql[p] == '_' || sql[p] == '$'); p++)
+        table += (char)::toupper(sql[p]);
+    return table;
+}
+// --bulk: recovers from earlier run that did not finish, then deactivates
+// indexes (and triggers) of target table. Returns false if import should
+// not go on
+bool FBExport::StartBulkLoad(IBPP::Database& db)
+{
+    if (!ar->Bulk)
+        return true;
+    string table = ImportTable();
+    if (table.empty())
+    {
+        Printf("Option --bulk needs -V, or INSERT INTO table in -Q.\n");
+        return false;
+    }
 
-    return ret;
+    Bulk = new BulkLoad(db, ar->Journal);
+    if (!Bulk->Recover())       // journal is kept, nothing else is done
+    {
+        delete Bulk;
+        Bulk = 0;
+        return false;
+    }
+    if (!Bulk->DisableIndexes(table)
+        || (ar->BulkTriggers && !Bulk->DisableTriggers(table)))
+    {
+        FinishBulkLoad();
+        return false;
+    }
+    return true;
+}
+// activates indexes and triggers again, indexes are rebuilt. Must be called
+// after import transaction has ended
+bool FBExport::FinishBulkLoad()
+{
+    if (!Bulk)
+        return true;
+    bool ok = Bulk->Restore();
+    delete Bulk;
+    Bulk = 0;
+    return ok;
+}
+// print checkpoint at each "ar->Checkpoint" lines, when count of rows went
+// from before to rows
+void FBExport::ImportCheckpoint(IBPP::Statement& st, int rows, int before)
+{
+    if (rows / ar->CheckPoint > before / ar->CheckPoint && rows > 0)
+    {
+        if (Worker)
+            Printf("Worker %d checkpoint at: %d lines.", Worker, rows);
+        else
+            Printf("Checkpoint at: %d lines.", rows);
+        if (ar->CommitOnCheckpoint)
+        {
+            IBPP::Transaction t = st->TransactionPtr();
+            if (t.intf())
+            {
+                t->Commit();
+                Printf(" Transaction commited.");
+                t->Start();     // start new transaction
+            }
+        }
+        Printf("\n");
+    }
 }
 std::string getAlign(IBPP::Statement& st, int col)
 {
@@ -811,27 +1397,41 @@ std::string getAlign(IBPP::Statement& st, int col)
     };
     return "";
 }
-// statement is prepared, just need to fetch all into file
-// returns: # of rows exported, -1 on error
-int FBExport::ExportHuman(IBPP::Statement& st, FILE *fp)
+// writes CSV header or beginning of HTML table
+void FBExport::ExportHumanHeader(IBPP::Statement& st, OutputSink& out)
 {
     int fc = st->Columns();
-
-    string prefix, suffix;
     if (ar->ExportFormat == xefCSV)
     {
-        Printf("Exporting data in CSV format...\n");
         for (int i=1; i<=fc; i++)   // output CSV header.
         {
             if (i > 1)
-                fprintf(fp, "%s", ar->Separator.c_str());
-            fprintf(fp, "%s", st->ColumnAlias(i));
+                out.Write(ar->Separator);
+            out.Write(st->ColumnAlias(i), strlen(st->ColumnAlias(i)));
         }
-        fprintf(fp, "\n");
+        out.Put('\n');
     }
-    else if (ar->ExportFormat == xefInserts)
+    else if (ar->ExportFormat == xefHTML)
+    {
+        out.Write(string("<HTML><BODY bgcolor=white><TABLE bgcolor=black cellspacing=1 cellpadding=3 border=0><tr bgcolor=white>\n"));
+        for (int i=1; i<=fc; i++)   // output CSV header.
+            out.Write("<td><b>" + string(st->ColumnAlias(i)) + "</b></td>");
+        out.Write(string("</tr>\n"));
+    }
+}
+void FBExport::ExportHumanFooter(OutputSink& out)
+{
+    if (ar->ExportFormat == xefHTML)
+        out.Write(string("</table></body></html>\n"));
+}
+// text that goes before and after each row, and before each field
+void FBExport::HumanRowLayout(IBPP::Statement& st, HumanLayout& layout)
+{
+    int fc = st->Columns();
+    string& prefix = layout.prefix;
+    string& suffix = layout.suffix;
+    if (ar->ExportFormat == xefInserts)
     {
-        Printf("Exporting data as INSERT statements...\n");
         string column_list;
         for (int i=1; i<=fc; i++)   // ... export all fields to file.
         {
@@ -844,49 +1444,101 @@ int FBExport::ExportHuman(IBPP::Statement& st, FILE *fp)
     }
     else if (ar->ExportFormat == xefHTML)
     {
-        Printf("Exporting data as HTML statements...\n");
-        fprintf(fp, "<HTML><BODY bgcolor=white><TABLE bgcolor=black cellspacing=1 cellpadding=3 border=0><tr bgcolor=white>\n");
-        for (int i=1; i<=fc; i++)   // output CSV header.
-            fprintf(fp, "<td><b>%s</b></td>", st->ColumnAlias(i));
-        fprintf(fp, "</tr>\n");
         prefix = "<tr bgcolor=white>";
         suffix = "</tr>";
     }
+    suffix += "\n";
 
-    time_t StartTime;
-    time(&StartTime);
+    layout.field.resize(fc + 1);
+    for (int i=1; i<=fc; i++)
+    {
+        if (ar->ExportFormat == xefHTML)
+            layout.field[i] = "<td" + getAlign(st, i) + ">";
+        else if (i > 1 && ar->ExportFormat == xefInserts)
+            layout.field[i] = ",";
+        else if (i > 1 && ar->ExportFormat == xefCSV)
+            layout.field[i] = ar->Separator;
+    }
+}
+// writes one row as CSV, INSERT statement or HTML table row
+// blobs are the same as for EncodeRow()
+void FBExport::EncodeHumanRow(OutputSink& out, IBPP::Row& row, HumanLayout& layout,
+    string& value, const string *blobs)
+{
+    out.Write(layout.prefix);
+    for (size_t i=1; i<layout.field.size(); i++)
+    {
+        out.Write(layout.field[i]);
+        CreateHumanString(row, i, blobs ? &blobs[i] : 0, value);
+        out.Write(value);
+        if (ar->ExportFormat == xefHTML)
+            out.Write("</td>", 5);
+    }
+    out.Write(layout.suffix);
+}
+// statement is executed, fetch all rows into output
+// returns: # of rows exported, -1 on error
+int FBExport::ExportHumanRows(IBPP::Statement& st, OutputSink& out, int worker)
+{
+    HumanLayout layout;
+    HumanRowLayout(st, layout);
 
-    // loop through all records in dataset, and ...
+    // loop through all records in dataset, and export them
     int ret=0;
+    string value;
+    IBPP::Row row = st->CurrentRow();
     while (st->Fetch())
     {
-        fprintf(fp, "%s", prefix.c_str());
-        for (int i=1; i<=fc; i++)   // ... export all fields to file.
+        EncodeHumanRow(out, row, layout, value, 0);
+        out.EndRow();
+
+        if (out.Failed())
         {
-            if (ar->ExportFormat == xefHTML)
-                fprintf(fp, "<td%s>%s</td>", getAlign(st, i).c_str(), CreateHumanString(st, i).c_str());
-            else
-            {
-                if (i > 1)
-                {
-                    if (ar->ExportFormat == xefInserts)
-                        fprintf(fp, ",");
-                    else if (ar->ExportFormat == xefCSV)
-                        fprintf(fp, "%s", ar->Separator.c_str());
-                }
-                fprintf(fp, "%s", CreateHumanString(st, i).c_str());
-            }
+            Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+            return -1;
         }
-        fprintf(fp, "%s\n", suffix.c_str());
 
         // print a checkpoint
         if (ret % ar->CheckPoint == 0 && ret)
-            Printf("Checkpoint at: %d lines.\n", ret);
+        {
+            if (worker)
+                Printf("Worker %d checkpoint at: %d lines.\n", worker, ret);
+            else
+                Printf("Checkpoint at: %d lines.\n", ret);
+        }
         ret++;
     }
+    return ret;
+}
+// statement is prepared, just need to fetch all into file
+// returns: # of rows exported, -1 on error
+int FBExport::ExportHuman(IBPP::Statement& st, OutputSink& out)
+{
+    if (ar->ExportFormat == xefCSV)
+        Printf("Exporting data in CSV format...\n");
+    else if (ar->ExportFormat == xefInserts)
+        Printf("Exporting data as INSERT statements...\n");
+    else if (ar->ExportFormat == xefHTML)
+        Printf("Exporting data as HTML statements...\n");
 
-    if (ar->ExportFormat == xefHTML)
-        fprintf(fp, "</table></body></html>\n");
+    time_t StartTime;
+    time(&StartTime);
+
+    ExportHumanHeader(st, out);
+    int ret;
+    if (ar->Encoders > 0)
+        ret = ExportPipeline(st, out, true);
+    else
+        ret = ExportHumanRows(st, out, 0);
+    if (ret < 0)
+        return -1;
+    ExportHumanFooter(out);
+
+    if (!out.Flush())
+    {
+        Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+        return -1;
+    }
 
     time_t EndTime;
     time(&EndTime);
@@ -901,6 +1553,10 @@ int FBExport::Init(Arguments *a)
     ar = a;         // move to internal
     int retval = 0;
     WereErrors = false;
+    Worker = 0;
+    SharedErrors = 0;
+    Bulk = 0;
+    HumanFormat.Set(ar->DateFormat, ar->TimeFormat, " ");
 
     // error while parsing, or insufficient args
     if (ar->Error != "OK")
@@ -913,10 +1569,12 @@ int FBExport::Init(Arguments *a)
                     (IBPP::Version >> 8) % 256,
                     IBPP::Version % 256);
         printf("Tool for importing/exporting data with Firebird databases.\n");
-        printf("Usage: fbexport -[S|Sc|Si|Sh|I|If|X|L] Options\n\n");
+        printf("Usage: fbexport -[S|Sb|Sc|Si|Sh|I|If|Ic|X|L] Options\n\n");
         printf(" -S  Select = output to file  (S - binary, Si - INSERTs, Sc - CSV, Sh - HTML)\n");
+        printf("              Sb - binary, stored column by column in blocks of rows\n");
         printf(" -I  Insert = input from file\n");
         printf(" -If Insert by Full SQL = input from file, by parameterized SQL\n");
+        printf(" -Ic, -Ifc = Insert from CSV file, first line has column names\n");
         printf(" -X  eXecute SQL statement, use with -F to execute sql scripts\n");
         printf(" -L  List connected users\n\n");
         printf("Options are:                           -H Host          [LOCALHOST]\n");
@@ -929,7 +1587,25 @@ int FBExport::Init(Arguments *a)
         printf(" -E # = Ignore up to # errors [0] Set to -1 to ignore all\n");
         printf(" -R Rollback transaction if any errors occur while importing [off]\n");
         printf(" -V Table = Verbatim copy of table (use -Q to set where clause if desired)\n");
-        printf(" -B Separator [,] = Field separator for CSV export. Allows special value: TAB\n");
+        printf(" -B Separator [,] = Field separator for CSV files. Allows special value: TAB\n");
+        printf(" -F |command = pipe exported data to a command, e.g. -F \"|gzip -c > data.gz\"\n");
+        printf("Tuning options:\n");
+        printf(" --buffer=# = Output buffer size in KB [%d]\n", OUTPUT_BUFFER_DEFAULT);
+        printf(" --workers=# = Export or import over # connections in parallel [1]. Export to\n");
+        printf("               file with %%d in name (i.e. -F part%%d.fbx) writes one per range\n");
+        printf(" --encoders[=#] = Fetch, encode and write rows in separate threads, using\n");
+        printf("               # threads to encode [all CPUs]\n");
+        printf(" --file-version=# = Version of fbx files written [%d], use %d for files\n",
+            FBEXPORT_FILE_VERSION, FBEXPORT_FILE_VERSION_TEXT);
+        printf("               that older versions of FBExport can import\n");
+        printf(" --compress[=#] = Compress fbx file using # threads [all CPUs]\n");
+        printf(" --batch[=#] = Import # rows at once with EXECUTE BLOCK [as many as fit].\n");
+        printf("               With -X, runs of INSERTs into one table are sent together\n");
+        printf(" --bulk[=triggers] = Deactivate indexes (and triggers) of table for import\n");
+        printf(" --journal=file = Journal of --bulk, to recover after crash [%s]\n",
+            BULK_JOURNAL_DEFAULT);
+        printf(" --stmt-cache=# = Keep # INSERTs of -X script prepared, with their values\n");
+        printf("               taken out as parameters\n");
         printf("Command-line options are not case-sensitive (except the TAB setting).\n\n");
         if (ar->Count > 1)
             printf("Error: %s\n", ar->Error.c_str());
@@ -937,11 +1613,31 @@ int FBExport::Init(Arguments *a)
         return 1;
     }
 
+    FileVersion = ar->FileVersion;
+    FileFlags = (ar->Columnar ? FBX_FLAG_COLUMNAR : 0);
+    if (ar->Compress)
+        FileFlags |= FBX_FLAG_COMPRESSED;
+    if (FileFlags && FileVersion < FBEXPORT_FILE_VERSION)
+    {
+        printf("Error: Options -Sb and --compress need file version %d.\n", FBEXPORT_FILE_VERSION);
+        return 9;
+    }
+    if (ar->Compress && ar->ExportFormat != xefDefault)
+    {
+        printf("Error: Option --compress only works with fbx files.\n");
+        return 9;
+    }
+
     if (ar->CommitOnCheckpoint && ar->Rollback)
     {
         printf("Error: Cannot use options -M and -R at the same time.\n");
         return 9;
     }
+    if (ar->Bulk && ar->Operation != xopInsert && ar->Operation != xopInsertFull)
+    {
+        printf("Error: Option --bulk only works with import (-I, -If).\n");
+        return 9;
+    }
 
     try
     {
@@ -1069,6 +1765,8 @@ int FBExport::Init(Arguments *a)
                     }
 
                     // create SQL (select + list + where clause)
+                    VerbatimColumns = colist;
+                    VerbatimWhere = ar->SQL;
                     ar->SQL = "SELECT " + colist + " FROM " + ar->VerbatimCopyTable + " " + ar->SQL;
                     Printf("SQL: %s\n", ar->SQL.c_str());
                 }
@@ -1076,9 +1774,6 @@ int FBExport::Init(Arguments *a)
                 Printf("Prepare statement...");
                 st1->Prepare(ar->SQL.c_str());
                 Printf("Done.\n");
-                Printf("Exec statement...");
-                st1->Execute();
-                Printf("Done.\n");
 
             // we need to open stdin and stdout in binary mode on Windows
 #ifdef IBPP_WINDOWS
@@ -1088,18 +1783,34 @@ int FBExport::Init(Arguments *a)
                 // if output is not binary, and filename is not given: output to stdout
                 if (ar->Filename == "" && ar->ExportFormat != xefDefault)
                     ar->Filename = "-";
-                FILE *fp = (ar->Filename == "-" ? stdout : fopen(ar->Filename.c_str(),
-                                                                (ar->ExportFormat == xefDefault ? "w+b" : "w+t")));
-                if (!fp)
+
+                int rows = -2;
+                if (ar->Workers > 1)
+                    rows = ExportParallel(db1, tr1, st1);
+                if (rows == -2)     // single connection
                 {
-                    Printf("Cannot open file: %s for writing.\n", ar->Filename.c_str());
-                    return -1;
+                    Printf("Exec statement...");
+                    st1->Execute();
+                    Printf("Done.\n");
+
+                    OutputSink *out = OutputSink::Open(ar->Filename,
+                        ar->ExportFormat != xefDefault, ar->OutputBuffer * 1024);
+                    if (!out)
+                    {
+                        Printf("Cannot open file: %s for writing.\n", ar->Filename.c_str());
+                        return -1;
+                    }
+                    if (ar->ExportFormat == xefDefault)
+                        rows = Export(st1, *out);
+                    else
+                        rows = ExportHuman(st1, *out);
+                    if (!out->Close() && rows >= 0)
+                    {
+                        Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+                        rows = -1;
+                    }
+                    delete out;
                 }
-                int rows;
-                if (ar->ExportFormat == xefDefault)
-                    rows = Export(st1, fp);
-                else
-                    rows = ExportHuman(st1, fp);
 
                 if (rows < 0)
                     Printf("Export failed.\n");
@@ -1111,8 +1822,6 @@ int FBExport::Init(Arguments *a)
                     else
                         Printf("%s.\n", ar->Filename.c_str());
                 }
-                if (ar->Filename != "-")
-                    fclose(fp);
             }
             //
             // IF WE ARE INSERTING
@@ -1173,39 +1882,37 @@ int FBExport::Init(Arguments *a)
                         f = ar->SQL.find(';');
                 }
 
-                // read first two bytes to see if file is compatible
-                int first = fgetc(fp);
-                int second = fgetc(fp);
-
-                if (first != 0 || second != FBEXPORT_FILE_VERSION)
-                {
-                    Printf("This file is not compatible with this version of FBExport\nPlease import the data to database with the same version you used to export.\n");
-                    return -1;
-                }
-
-                // Read field count
-                fieldcount = fgetc(fp);
-
-                // add values clause to insert statement
-                // only if op = 'I'
-                if (ar->Operation == xopInsert)
+                InputSource in(fp);
+                int rows;
+                if (ar->ExportFormat == xefCSV)     // -Ic, columns are in header line
+                    rows = (StartBulkLoad(db1) ? ImportCsv(st1, in) : -1);
+                else
                 {
-                    ar->SQL += " VALUES (";
-                    char num[10];
-                    for (int i=0; i<fieldcount; i++)
+                    // read first two bytes to see if file is compatible
+                    int first = in.Get();
+                    int second = in.Get();
+
+                    FileVersion = second;
+                    FileFlags = 0;
+                    if (second == FBEXPORT_FILE_VERSION)
+                        FileFlags = in.Get();
+                    if (first != 0 || (FileFlags & ~(FBX_FLAG_COLUMNAR | FBX_FLAG_COMPRESSED)) != 0
+                        || (second != FBEXPORT_FILE_VERSION && second != FBEXPORT_FILE_VERSION_TEXT))
                     {
-                        if (i)
-                            ar->SQL += ",";
-                        sprintf(num, "%d", i+1);
-                        ar->SQL += ":" + (string)num;
+                        Printf("This file is not compatible with this version of FBExport\nPlease import the data to database with the same version you used to export.\n");
+                        return -1;
                     }
-                    ar->SQL += ")";
-                }
 
-                // Build parameter map
-                BuildParamMap();
+                    // Read field count
+                    fieldcount = in.Get();
+
+                    AddValuesClause();
+
+                    // Build parameter map
+                    BuildParamMap();
 
-                int rows = Import(st1, fp);
+                    rows = (StartBulkLoad(db1) ? Import(st1, in) : -1);
+                }
                 if (rows < 0)
                 {
                     retval = 6;
@@ -1262,6 +1969,8 @@ int FBExport::Init(Arguments *a)
         retval = 5;
     }
 
+    if (!FinishBulkLoad() && retval == 0)   // after transaction has ended
+        retval = 10;
     return retval;
 }
 
@@ -1310,169 +2019,209 @@ void FBExport::BuildParamMap()
 // Author: Istvan Matyasi
 //
 // Replaces all occurrences of param number i of type ft with string src in statement st
-void FBExport::StringToNumParams(string src, IBPP::Statement& st, int i, IBPP::SDT ft)
+void FBExport::StringToNumParams(const string& src, IBPP::Statement& st, int i, IBPP::SDT ft)
+{
+    ColumnPlan& p = Plan[i-1];
+    for (size_t j = 0; j < p.params.size(); j++)
+        StringToParam(src, st, p.params[j], ft, p.scales[j]);
+}
+
+// Same as StringToNumParams, for values stored in binary form
+void FBExport::BinaryToNumParams(const char *src, int size, IBPP::Statement& st, int i)
 {
-    for (set<int>::iterator j = parmap[i].begin(); j != parmap[i].end(); j++)
-        StringToParam (src, st, *j, ft);
+    ColumnPlan& p = Plan[i-1];
+    for (size_t j = 0; j < p.params.size(); j++)
+    {
+        if (p.bind)
+            p.bind(st, p.params[j], src, size, p.factors[j]);
+        else
+            st->SetNull(p.params[j]);
+    }
 }
 
-int statement_length(FILE *fp)
+void FBExport::ScriptStart(ScriptRun& r)
 {
-    int    c = 0, tmp = 0;
-    int    l = 0;
-    fpos_t pos;
-    fgetpos(fp, &pos);
-    bool comments = false;
-    bool comments_over = false;
+    if (r.started)
+        return;
+    r.tr->Start();
+    r.started = true;
+    if (!r.byme)
+        Printf("Transaction started.\n");
+    r.byme = false;
+}
 
-    while (';' != c && (c = getc(fp)) != EOF)
+// counts executed statement, commits at checkpoint if asked to (-M)
+void FBExport::ScriptCheckpoint(ScriptRun& r)
+{
+    if (++r.statements % ar->CheckPoint == 0)
     {
-        switch(c)
+        if (ar->CommitOnCheckpoint)
         {
-            case '\r':
-            case '\n':
-                break;
-            case '/':
-                if((tmp = getc(fp)) == '*')
-                    comments = true;
-                else if(tmp != EOF)
-                    ungetc(tmp, fp);
-                break;
-            case '*':
-                if((tmp = getc(fp)) == '/' && comments)
-                    comments_over = true;
-                else if(tmp != EOF)
-                    ungetc(tmp, fp);
-                break;
+            r.tr->Commit();
+            r.started = false;
+            r.byme = true;
+            Printf("Checkpoint at: %d statements. Transaction commited.\n", r.statements);
         }
-        if(!comments)
-            l++;
-        if (comments_over)
-            comments_over = comments = false;
+        else
+            Printf("Checkpoint at: %d statements.\n", r.statements);
     }
-    fsetpos(fp, &pos);
-
-    if (EOF == c && l == 0)
-        return l;
-    return (ferror (fp)) ? -1 : l;
 }
 
-char *read_statement(char *s, int n, FILE *fp)
+// false if execution should stop because of too many errors (-E)
+bool FBExport::ScriptExecute(ScriptRun& r, const ScriptStatement& s)
 {
-    int    c = 0, tmp = 0;
-    char   *P;
-    P = s;
-    bool comments = false;
-    bool comments_over = false;
-
-    while (';' != c && --n > 0 && (c = getc(fp)) != EOF)
+    try
     {
-        switch(c)
+        ScriptStart(r);
+        if (!ar->StmtCache || !ExecuteCached(r.st->DatabasePtr(), r.tr, s.sql))
         {
-            case '\r':
-            case '\n':
-                break;
-            case '/':
-                if((tmp = getc(fp)) == '*')
-                    comments = true;
-                else if(tmp != EOF)
-                    ungetc(tmp, fp);
-                break;
-            case '*':
-                if((tmp = getc(fp)) == '/' && comments)
-                    comments_over = true;
-                else if(tmp != EOF)
-                    ungetc(tmp, fp);
-                break;
+            if (SqlScript::NoResultSet(s.sql))
+                r.st->ExecuteImmediate(s.sql);  // one round-trip
+            else
+                r.st->Execute(s.sql);
         }
-        if(!comments)
-            *P++ = (char)c;
-        if (comments_over)
-            comments_over = comments = false;
+        ScriptCheckpoint(r);
+    }
+    catch (IBPP::Exception &e)
+    {
+        CurrentData = s.sql;
+        Printf("\nIBPP Error in statement at line %d (offset %lld): %s\n",
+            s.line, (long long)s.offset, e.ErrorMessage());
+        WereErrors = true;
+        r.errors++;
+        if (ar->IgnoreErrors > -1 && r.errors > ar->IgnoreErrors)
+            return false;
     }
+    return true;
+}
 
-    if (EOF == c && P == s)
-        return( NULL );
-    *P = 0;
-    return (ferror (fp)) ? NULL : s;
+// true if statement can be queued for EXECUTE BLOCK (--batch)
+bool FBExport::ScriptBatchable(const ScriptStatement& s, string& table)
+{
+    if (ar->Batch < 2 || Dialect < 3 || !SqlScript::StartsWith(s.sql, "INSERT")
+        || !SqlScript::NoResultSet(s.sql))
+    {
+        return false;
+    }
+    table = insertTable(s.sql);
+    return !table.empty() && s.sql.length() + 32 < BATCH_MAX_SQL;
 }
 
-int FBExport::ExecuteSqlScript(IBPP::Statement& st, IBPP::Transaction &tr, FILE *fp)
+// runs queued INSERTs in one EXECUTE BLOCK. If it fails, nothing of it is
+// done, and statements are run one by one to find and report those that fail.
+// If none of them fails, the block was too big (i.e. too many contexts), so
+// later blocks are made smaller
+bool FBExport::ScriptFlush(ScriptRun& r)
 {
-    int Errors = 0;
-    int length;
-    int buffer_size = 1024;
-    char *buffer;
-    const char *commit_string = "COMMIT";
-    int commit_string_length;
-    bool transaction_started = false;
-    bool byme = false;
-    commit_string_length = strlen(commit_string);
-    buffer = new char[buffer_size];
-    if(!buffer)
-        return -1;
-    int result = 0;
-    do
+    if (r.batch.empty())
+        return true;
+    bool ok = true;
+    if (r.batch.size() == 1)
+        ok = ScriptExecute(r, r.batch[0]);
+    else
     {
-        length = statement_length(fp);
-        if(length < 1)
-            break;
-        if((length + 1) > buffer_size)
+        string block("EXECUTE BLOCK AS BEGIN\n");
+        for (size_t i = 0; i < r.batch.size(); i++)
+            block.append(r.batch[i].sql).append(";\n");
+        block += "END";
+        bool executed = false;
+        try
         {
-            buffer_size = length + 1;
-            delete[] buffer;
-            buffer = new char[buffer_size];
-            if(!buffer)
-                return -1;
+            ScriptStart(r);
+            r.st->ExecuteImmediate(block);
+            executed = true;
         }
-        if(read_statement(buffer, buffer_size, fp))
+        catch (IBPP::Exception&)
         {
-            CurrentData = buffer;
-            if(strnicmp(buffer, commit_string, min(length, commit_string_length)) == 0
-                && transaction_started)
+            int errors = r.errors;
+            for (size_t i = 0; ok && i < r.batch.size(); i++)
+                ok = ScriptExecute(r, r.batch[i]);
+            if (ok && r.errors == errors && r.batchLimit > 1)
             {
-                tr->Commit();
-                Printf("Transaction commited.\n");
-                transaction_started = false;
-                byme = false;
-                continue;
+                r.batchLimit = (int)r.batch.size() / 2;
+                if (r.batchLimit < 2)
+                    Printf("INSERTs cannot be batched, running them one by one.\n");
             }
-            try
+        }
+        // outside of try above, so that a failed commit at checkpoint does
+        // not run statements of the block again
+        try
+        {
+            for (size_t i = 0; executed && i < r.batch.size(); i++)
+                ScriptCheckpoint(r);
+        }
+        catch (IBPP::Exception &e)
+        {
+            Printf("\nIBPP Error at checkpoint: %s\n", e.ErrorMessage());
+            WereErrors = true;
+            ok = false;
+        }
+    }
+    r.batch.clear();
+    r.batchBytes = 0;
+    return ok;
+}
+
+int FBExport::ExecuteSqlScript(IBPP::Statement& st, IBPP::Transaction &tr, FILE *fp)
+{
+    ScriptRun r;
+    r.st = st;
+    r.tr = tr;
+    r.statements = 0;
+    r.errors = 0;
+    r.started = false;
+    r.byme = false;
+    r.batchBytes = 0;
+    r.batchLimit = (ar->Batch < BATCH_MAX_ROWS ? ar->Batch : BATCH_MAX_ROWS);
+
+    SqlScript script(fp);
+    ScriptStatement s;
+    bool ok = true;
+    while (ok && script.Next(s.sql))
+    {
+        s.line = script.Line();
+        s.offset = script.Offset();
+        CurrentData = s.sql;
+
+        string table;
+        if (ScriptBatchable(s, table))
+        {
+            if ((table != r.batchTable || r.batchBytes + s.sql.length() + 32 > BATCH_MAX_SQL)
+                && !ScriptFlush(r))
             {
-                if(!transaction_started)
-                {
-                    tr->Start();
-                    transaction_started = true;
-                    if (!byme)
-                        Printf("Transaction started.\n");
-                    byme = false;
-                }
-                st->Execute(CurrentData);
-                if (++result % ar->CheckPoint == 0)     // increase statement counter
-                {
-                    if (ar->CommitOnCheckpoint)
-                    {
-                        tr->Commit();
-                        transaction_started = false;
-                        byme = true;
-                        Printf("Checkpoint at: %d statements. Transaction commited.\n", result);
-                    }
-                    else
-                        Printf("Checkpoint at: %d statements.\n", result);
-                }
+                break;
             }
-            catch (IBPP::Exception &e)
+            r.batch.push_back(s);
+            r.batchTable = table;
+            r.batchBytes += s.sql.length() + 2;
+            // block ends at checkpoint, so that -M commits at the same place
+            int toCheckpoint = ar->CheckPoint - (r.statements % ar->CheckPoint);
+            if ((int)r.batch.size() >= r.batchLimit || (int)r.batch.size() >= toCheckpoint)
+                ok = ScriptFlush(r);
+            continue;
+        }
+        if (!ScriptFlush(r))
+            break;
+
+        if (SqlScript::StartsWith(s.sql, "COMMIT"))
+        {
+            if (r.started)
             {
-                Printf("\nIBPP Error: %s\n", e.ErrorMessage());
-                WereErrors = true;
-                if (ar->IgnoreErrors > -1 && ++Errors > ar->IgnoreErrors)
-                    break;
+                tr->Commit();
+                Printf("Transaction commited.\n");
+                r.started = false;
+                r.byme = false;
             }
+            continue;
         }
-    } while (!feof(fp));
-    delete[] buffer;
+        ok = ScriptExecute(r, s);
+    }
+    if (ok)
+        ScriptFlush(r);
+    Cache.clear();
+    CacheOrder.clear();
 
-    if (transaction_started)
+    if (r.started)
     {
         if (ar->Rollback && WereErrors)
         {
@@ -1485,5 +2234,5 @@ int FBExport::ExecuteSqlScript(IBPP::Statement& st, IBPP::Transaction &tr, FILE
             Printf("Transaction commited.\n");
         }
     }
-    return result;
+    return r.statements;
 }
@@ -29,15 +29,33 @@
 #ifndef FBExportH
 #define FBExportH
 
-#define FBEXPORT_FILE_VERSION 180
-#define FBEXPORT_VERSION "1.80"
+#define FBEXPORT_FILE_VERSION 190         // numbers and dates stored binary
+#define FBEXPORT_FILE_VERSION_TEXT 180    // all values stored as text
+
+// flags in header of version 190
+#define FBX_FLAG_COLUMNAR 1     // data in blocks of rows, stored column by column
+#define FBX_FLAG_COMPRESSED 2   // data after header is in compressed frames
+
+#define FBX_BLOCK_ROWS 4096             // rows per columnar block
+#define FBX_BLOCK_BYTES (16*1024*1024)  // block is ended earlier if it gets this big
+
+#define BATCH_MAX_ROWS 255      // rows per EXECUTE BLOCK, each uses one context
+#define BATCH_MAX_SQL 65535     // length of statement text
+#define FBEXPORT_VERSION "1.90"
 #include "ParseArgs.h"
+#include "OutputSink.h"
+#include "InputSource.h"
+#include "Formatting.h"
+#include "BulkLoad.h"
 #include "ibpp.h"
 
+#include <atomic>
 #include <exception>
+#include <list>
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 
 class DataFormatException: public std::exception
@@ -54,6 +72,101 @@ public:
     }
 };
 
+// numbers in fbx files are little-endian, on any platform
+void encodeLE(char *dest, uint64_t value, int bytes);
+int64_t decodeLE(const char *src, int bytes);
+// blob segment length, stored as 4 ASCII digits. -1 if invalid
+int segmentLength(const char *p);
+
+// value * factor (rescaled integer), throws DataFormatException on overflow
+int64_t scaleInteger(int64_t value, int64_t factor);
+// set parameter straight in its native form, type is parameter's type
+void setRawInteger(IBPP::Statement& st, int param, IBPP::SDT type, int64_t value);
+void setRawDate(IBPP::Statement& st, int param, int date);
+void setRawTime(IBPP::Statement& st, int param, int time);
+void setRawTimestamp(IBPP::Statement& st, int param, int date, int time);
+
+// name of table after INTO, as stored in system tables. Empty if not found
+string insertTable(const string& sql);
+
+// text around CSV, INSERT and HTML rows, see HumanRowLayout()
+struct HumanLayout
+{
+    string prefix;
+    string suffix;
+    vector<string> field;       // goes before each field
+};
+
+// INSERT of -X script prepared with its literals as parameters, see
+// StatementCache.cpp
+struct CachedStatement
+{
+    IBPP::Statement st;         // 0 if statement cannot be cached
+    vector<IBPP::SDT> types;
+    vector<int> scales;
+    vector<int> sizes;          // of string parameters
+    list<string>::iterator age; // position in FBExport::CacheOrder
+};
+
+// statement of -X script
+struct ScriptStatement
+{
+    string sql;
+    int line;
+    int64_t offset;
+};
+
+// state of -X script run, see ExecuteSqlScript()
+struct ScriptRun
+{
+    IBPP::Statement st;
+    IBPP::Transaction tr;
+    int statements;             // executed so far
+    int errors;
+    bool started;               // transaction is running
+    bool byme;                  // it was committed at checkpoint
+    vector<ScriptStatement> batch;  // INSERTs waiting for EXECUTE BLOCK
+    string batchTable;
+    size_t batchBytes;
+    int batchLimit;             // halved when a block fails but its rows don't
+};
+
+struct ExportJob;
+struct ExportPipe;
+struct ImportJob;
+
+// decodes value stored in binary form (file version 190) and sets parameter
+// param to it. factor rescales integers to parameter's scale
+typedef void (*ParamBinder)(IBPP::Statement& st, int param, const char *src,
+    int size, int64_t factor);
+
+// how one column of imported file is bound to statement, see CompilePlan()
+struct ColumnPlan
+{
+    ParamBinder bind;           // for binary files, 0 if type is not supported
+    vector<int> params;         // parameters that take the value, none if unused
+    vector<int> scales;         // scale of each parameter
+    vector<int64_t> factors;    // 10^(parameter scale - file scale), integers only
+    vector<IBPP::SDT> types;    // type of each parameter, for CSV import
+};
+
+// rows of import queued for one EXECUTE BLOCK, see BatchImport.cpp
+struct ImportBatch
+{
+    IBPP::Statement block;              // import statement, capacity times
+    map<int, IBPP::Statement> parts;    // smaller blocks, for the rest of rows
+                                        // and for halves of failed blocks
+    vector<string> declarations;        // types of one row's parameters
+    int params;                         // parameters of one row
+    int capacity;                       // rows in block
+    int rows;                           // rows queued so far
+};
+struct ColumnChunk;
+struct ColumnData;
+struct CsvChunk;
+struct DecodedBatch;
+struct ImportPipe;
+
 class FBExport
 {
 private:
@@ -66,26 +179,129 @@ private:
     string CurrentData;
 
     ParamMap parmap;
+    vector<ColumnPlan> Plan;    // for each column of file, built after Prepare
     int fieldcount;
+    int FileVersion;            // version of fbx file being read or written
+    int FileFlags;              // FBX_FLAG_xxx
+    vector<int> FileScales;     // scale of each column, from file header
+
+    string VerbatimColumns;     // column list and where clause for -V
+    string VerbatimWhere;
+    DateTimeFormat HumanFormat; // -J and -K, compiled in Init
+
+    int Worker;                 // number of parallel import thread, 0 = main
+    atomic<int> *SharedErrors;  // errors of all import threads, or 0
+    BulkLoad *Bulk;             // --bulk session, or 0
+    map<string, CachedStatement> Cache; // --stmt-cache, by statement shape
+    list<string> CacheOrder;    // keys of Cache, most recently used first
 
     unsigned char SDT2uc(IBPP::SDT st);
-    void StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT ft);
-    bool CreateString(IBPP::Statement& st, int col, string &value);
-    string CreateHumanString(IBPP::Statement& st, int col);
-    string GetHumanDate(int year, int month, int day);
-    string GetHumanTime(int hour, int minute, int second);
-    string GetHumanTimestamp(IBPP::Timestamp ts);
+    void StringToParam(string src, IBPP::Statement& st, int i, IBPP::SDT ft,
+        int scale);
+    bool CreateString(IBPP::Row& row, int col, string &value);
+    void CreateHumanString(IBPP::Row& row, int col, const string *blob, string& value);
+    void AppendEscaped(string& dest, const char *data, size_t len, bool numeric);
     void MakeInsertSQL(IBPP::Statement& st1, FILE*fp);
     void BuildParamMap();
-    void StringToNumParams(string src, IBPP::Statement& st, int i, IBPP::SDT ft);
+    void StringToNumParams(const string& src, IBPP::Statement& st, int i, IBPP::SDT ft);
+    void CheckParamType(IBPP::Statement& st, int i, IBPP::SDT ft);
+    void CompilePlan(IBPP::Statement& st, IBPP::SDT *ft);
+    int EncodeBinary(IBPP::Row& row, int col, IBPP::SDT type, char *dest);
+    void WriteBinary(OutputSink& out, IBPP::Row& row, int col, IBPP::SDT type);
+    void BinaryToNumParams(const char *src, int size, IBPP::Statement& st, int i);
+    string BinaryToString(const char *src, int size, IBPP::SDT ft, int scale);
+
+    void ExportHeader(IBPP::Statement& st, OutputSink& out);
+    void FileTypes(IBPP::Statement& st, vector<IBPP::SDT>& types);
+    void EncodeRow(OutputSink& out, IBPP::Row& row, vector<IBPP::SDT>& types,
+        string& value, const string *blobs);
+    int ExportRows(IBPP::Statement& st, OutputSink& out, int worker);
+    int Export(IBPP::Statement& st, OutputSink& out);
+    void ExportHumanHeader(IBPP::Statement& st, OutputSink& out);
+    void ExportHumanFooter(OutputSink& out);
+    void HumanRowLayout(IBPP::Statement& st, HumanLayout& layout);
+    void EncodeHumanRow(OutputSink& out, IBPP::Row& row, HumanLayout& layout,
+        string& value, const string *blobs);
+    int ExportHumanRows(IBPP::Statement& st, OutputSink& out, int worker);
+    int ExportHuman(IBPP::Statement& st, OutputSink& out);
+
+    // export pipeline: fetch, encode and write in separate threads
+    int ExportPipeline(IBPP::Statement& st, OutputSink& out, bool human);
+    void EncodeBatches(ExportPipe *pipe);
+    void WriteBatches(ExportPipe *pipe, OutputSink *out);
+    bool PlanRanges(IBPP::Transaction& tr, IBPP::Statement& st, vector<string>& ranges);
+    bool StartWorkers(IBPP::Database& db, IBPP::Transaction& tr,
+        const set<string>& tables, vector<ExportJob>& jobs);
+    void ExportWorker(ExportJob *job);
+    int ExportParallel(IBPP::Database& db, IBPP::Transaction& tr, IBPP::Statement& st);
+    int Import(IBPP::Statement& st, InputSource& in);
+    bool SkipRow(InputSource& in, IBPP::SDT *ft);
+    bool SkipBlock(InputSource& in);
+    bool SplitInput(InputSource& in, IBPP::SDT *ft, vector<size_t>& cuts);
+    void ImportWorker(ImportJob *job, InputSource *in, IBPP::SDT *ft);
+    int ImportParallel(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft);
+    int ImportRows(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+        ImportBatch *batch);
+    bool DecodeRow(InputSource& in, IBPP::SDT *ft, DecodedBatch& b, bool& corrupt);
+    void DecodeRows(ImportPipe *pipe, InputSource *in, IBPP::SDT *ft);
+    void BindBlob(IBPP::Statement& st, int col, const char *data, int len);
+    int ImportPipeline(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+        ImportBatch *batch);
+    void BinaryRowData(IBPP::SDT *ft, const char **values, const int *lengths);
+    bool RowFailed(int& Errors);
+    void ImportCheckpoint(IBPP::Statement& st, int rows, int before);
+    void AddValuesClause();
+    string ImportTable();
+    bool StartBulkLoad(IBPP::Database& db);
+    bool FinishBulkLoad();
+
+    // CSV import, see CsvImport.cpp
+    int ImportCsv(IBPP::Statement& st, InputSource& in);
+    bool CsvHeader(CsvChunk& c);
+    void CompileCsvPlan(IBPP::Statement& st);
+    bool BindText(IBPP::Statement& st, int col, const char *data, int len);
+    bool BindTextParam(IBPP::Statement& st, int param, IBPP::SDT type,
+        int scale, const char *data, int len);
+    bool ImportCsvChunk(IBPP::Statement& st, CsvChunk& c, size_t first,
+        ImportBatch *batch, int& ret, int& Errors, vector<string>& rowData,
+        int& slot);
+
+    // batched import, many rows in one EXECUTE BLOCK
+    bool DeclareParameter(IBPP::Statement& st, int i,
+        map<int, pair<string, int> >& charsets, string& decl);
+    string BlockSQL(ImportBatch *batch, int rows);
+    ImportBatch *PrepareBatch(IBPP::Statement& st);
+    bool QueueRow(IBPP::Statement& st, ImportBatch *batch);
+    IBPP::Statement BatchBlock(IBPP::Statement& st, ImportBatch *batch,
+        int first, int rows);
+    int ExecuteRows(IBPP::Statement& st, ImportBatch *batch, int first,
+        int rows, vector<int>& failed);
+    int ExecuteBatch(IBPP::Statement& st, ImportBatch *batch, vector<int>& failed);
+    bool FlushBatch(IBPP::Statement& st, ImportBatch *batch, IBPP::SDT *ft,
+        int& ret, int& Errors, vector<string>& rowData,
+        vector<const char *>& fieldPtr, vector<int>& fieldLen);
 
-    int Export(IBPP::Statement& st, FILE *fp);
-    int ExportHuman(IBPP::Statement& st, FILE *fp);
-    int Import(IBPP::Statement& st, FILE *fp);
+    // columnar layout
+    int ExportBlocks(IBPP::Statement& st, OutputSink& out, int worker);
+    void AppendBlob(string& dest, IBPP::Blob& b);
+    void AppendColumn(ColumnChunk& c, IBPP::Statement& st, IBPP::RowBlock& block,
+        int col, IBPP::SDT type, int rows, IBPP::Blob& blob);
+    void WriteColumnBlock(OutputSink& out, vector<IBPP::SDT>& types,
+        vector<ColumnChunk>& chunks, int rows);
+    int ImportBlocks(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+        ImportBatch *batch);
+    bool ReadColumn(InputSource& in, ColumnData& c, IBPP::SDT type, int rows);
+    void BindColumn(IBPP::Statement& st, ColumnData& c, int col, int row);
     int ExecuteSqlScript(IBPP::Statement& st, IBPP::Transaction &tr, FILE *fp);
+    void ScriptStart(ScriptRun& r);
+    void ScriptCheckpoint(ScriptRun& r);
+    bool ScriptExecute(ScriptRun& r, const ScriptStatement& s);
+    bool ScriptBatchable(const ScriptStatement& s, string& table);
+    bool ScriptFlush(ScriptRun& r);
+    bool ExecuteCached(IBPP::Database db, IBPP::Transaction& tr, const string& sql);
 
-    void WriteBlob(FILE *fp, IBPP::Statement& st, int col);
-    int ReadBlob(FILE *fp, IBPP::Statement& st, int col, bool needed);
+    void WriteBlob(OutputSink& out, IBPP::Row& row, int col, const string *data);
+    int ReadBlob(InputSource& in, IBPP::Statement& st, int col, bool needed);
 
     // output abstraction layer, for cmdline it calls printf(), and for GUI it fills the textbox
     void Printf(const char *format, ...);
@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : InputSource.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Implementation of buffered input layer
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifdef IBPP_WINDOWS
+#include <windows.h>
+#include <io.h>
+#endif
+
+#ifdef IBPP_LINUX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "Compression.h"
+#include "InputSource.h"
+
+InputSource::InputSource(FILE *fp, size_t bufferSize)
+    : fileM(fp), bufferM(bufferSize), dataM(&bufferM[0]), posM(0), endM(0),
+    eofM(false), failedM(false), mapM(0), mapSizeM(0), mapPosM(0),
+    mapOwnerM(true), compressedM(false), pendingPosM(0)
+{
+    Map();
+}
+
+InputSource::InputSource(const InputSource& file, size_t from, size_t to)
+    : fileM(0), dataM(file.mapM + from), posM(0), endM(0), eofM(false),
+    failedM(false), mapM(file.mapM + from), mapSizeM(to - from), mapPosM(0),
+    mapOwnerM(false), compressedM(false), pendingPosM(0)
+{
+}
+
+InputSource::~InputSource()
+{
+    if (!mapM || !mapOwnerM)
+        return;
+#ifdef IBPP_WINDOWS
+    UnmapViewOfFile(mapM);
+    CloseHandle((HANDLE)mapHandleM);
+#else
+    munmap((void *)mapM, mapSizeM);
+#endif
+}
+
+// maps regular files into memory, so data doesn't have to be copied.
+// Anything that cannot be mapped (stdin from pipe, huge files on 32 bit
+// systems) is read with fread()
+void InputSource::Map()
+{
+    long start = ftell(fileM);      // nothing read yet, but stdin could be
+    if (start < 0)                  // positioned anywhere
+        return;
+#ifdef IBPP_WINDOWS
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(fileM));
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE || GetFileType(file) != FILE_TYPE_DISK
+        || !GetFileSizeEx(file, &size) || size.QuadPart <= start
+        || (uint64_t)size.QuadPart > SIZE_MAX / 4)
+    {
+        return;
+    }
+    HANDLE map = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!map)
+        return;
+    void *p = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (!p)
+    {
+        CloseHandle(map);
+        return;
+    }
+    mapHandleM = map;
+    mapSizeM = (size_t)size.QuadPart;
+#else
+    struct stat info;
+    if (fstat(fileno(fileM), &info) != 0 || !S_ISREG(info.st_mode)
+        || info.st_size <= start || (uint64_t)info.st_size > SIZE_MAX / 4)
+    {
+        return;
+    }
+    void *p = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fileM), 0);
+    if (p == MAP_FAILED)
+        return;
+    madvise(p, info.st_size, MADV_SEQUENTIAL);
+    mapSizeM = info.st_size;
+#endif
+    mapM = (const char *)p;
+    mapPosM = start;
+}
+
+// reads from file, bytes read ahead are used first
+size_t InputSource::ReadRaw(char *dest, size_t len)
+{
+    size_t done = pendingM.length() - pendingPosM;
+    if (done > 0)
+    {
+        if (done > len)
+            done = len;
+        memcpy(dest, pendingM.data() + pendingPosM, done);
+        pendingPosM += done;
+    }
+    if (done < len && mapM)
+    {
+        size_t chunk = mapSizeM - mapPosM;
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy(dest + done, mapM + mapPosM, chunk);
+        mapPosM += chunk;
+        done += chunk;
+    }
+    else if (done < len)
+        done += fread(dest + done, 1, len - done, fileM);
+    return done;
+}
+
+// loads next block of data into buffer, returns false at end of file
+// mapped file is a single block, unless it is compressed
+bool InputSource::Fill()
+{
+    posM = endM = 0;
+    if (eofM)
+        return false;
+
+    if (!compressedM && mapM)
+    {
+        dataM = mapM + mapPosM;
+        endM = mapSizeM - mapPosM;
+        mapPosM = mapSizeM;
+    }
+    else if (!compressedM)
+    {
+        dataM = &bufferM[0];
+        endM = ReadRaw(&bufferM[0], bufferM.size());
+    }
+    else
+    {
+        char header[COMPRESS_FRAME_HEADER];
+        size_t got = ReadRaw(header, COMPRESS_FRAME_HEADER);
+        size_t len, packed;
+        if (got == COMPRESS_FRAME_HEADER && frameSizes(header, len, packed))
+        {
+            if (bufferM.size() < len)
+                bufferM.resize(len);
+            dataM = &bufferM[0];
+
+            const char *src = 0;    // packed frame, taken from mapping as is
+            if (mapM)
+            {
+                if (mapSizeM - mapPosM >= packed)
+                {
+                    src = mapM + mapPosM;
+                    mapPosM += packed;
+                }
+            }
+            else
+            {
+                if (packedM.size() < packed)
+                    packedM.resize(packed);
+                if (ReadRaw(&packedM[0], packed) == packed)
+                    src = &packedM[0];
+            }
+            if (src && decompressFrame(src, packed, &bufferM[0], len))
+                endM = len;
+            else
+                failedM = true;
+        }
+        else if (got != 0)
+            failedM = true;
+    }
+
+    if (endM == 0)
+        eofM = true;
+    return !eofM;
+}
+
+const char *InputSource::ViewBlock(size_t& len)
+{
+    len = 0;
+    if (posM == endM && !Fill())
+        return 0;
+    const char *p = dataM + posM;
+    len = endM - posM;
+    posM = endM;
+    return p;
+}
+
+size_t InputSource::Read(void *dest, size_t len)
+{
+    char *d = (char *)dest;
+    size_t done = 0;
+    while (done < len)
+    {
+        if (posM == endM && !Fill())
+            break;
+        size_t chunk = endM - posM;
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy(d + done, dataM + posM, chunk);
+        posM += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+// value crosses the end of current block, copy it
+const char *InputSource::ViewSpan(size_t len)
+{
+    if (spanM.size() < len)
+        spanM.resize(len);
+    if (Read(&spanM[0], len) != len)
+        return 0;
+    return &spanM[0];
+}
+
+void InputSource::StartDecompression()
+{
+    if (mapM)       // the rest of mapped file is still there
+        mapPosM -= endM - posM;
+    else
+    {
+        pendingM.assign(dataM + posM, endM - posM);
+        pendingPosM = 0;
+    }
+    posM = endM = 0;
+    compressedM = true;
+}
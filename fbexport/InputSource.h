@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : InputSource.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Input layer used by importer. Regular files are mapped
+//                into memory, other input (stdin, pipes) is read in big
+//                blocks. Also unpacks compressed data
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef InputSourceH
+#define InputSourceH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define INPUT_BUFFER_DEFAULT    1024        // in KB
+
+class InputSource
+{
+private:
+    FILE *fileM;
+    std::vector<char> bufferM;
+    const char *dataM;          // current block, in bufferM or mapped file
+    size_t posM;
+    size_t endM;
+    bool eofM;
+    bool failedM;
+
+    const char *mapM;           // whole file, if it could be mapped
+    size_t mapSizeM;
+    size_t mapPosM;             // bytes of mapping handed out so far
+    bool mapOwnerM;             // false for part of other source's mapping
+#ifdef IBPP_WINDOWS
+    void *mapHandleM;
+#endif
+
+    bool compressedM;
+    std::string pendingM;       // read ahead before compression started
+    size_t pendingPosM;
+    std::vector<char> packedM;
+    std::vector<char> spanM;    // View() of data spanning two blocks
+
+    void Map();
+    bool Fill();
+    size_t ReadRaw(char *dest, size_t len);
+    const char *ViewSpan(size_t len);
+
+    // no copying
+    InputSource(const InputSource&);
+    InputSource& operator=(const InputSource&);
+
+public:
+    InputSource(FILE *fp, size_t bufferSize = INPUT_BUFFER_DEFAULT * 1024);
+    // bytes from..to of mapped file, which must exist while this object does
+    InputSource(const InputSource& file, size_t from, size_t to);
+    ~InputSource();
+
+    // same as fgetc()
+    inline int Get()
+    {
+        if (posM == endM && !Fill())
+            return EOF;
+        return (unsigned char)dataM[posM++];
+    }
+    // same as fread(dest, 1, len, fp)
+    size_t Read(void *dest, size_t len);
+    // returns pointer to next len bytes and skips them, or 0 if there are
+    // not that many. Data is only copied when it spans two blocks. Unless
+    // Mapped() is true, it is valid until the next call
+    inline const char *View(size_t len)
+    {
+        if (endM - posM < len)
+            return ViewSpan(len);
+        const char *p = dataM + posM;
+        posM += len;
+        return p;
+    }
+    // returns pointer to the rest of current block and skips it, len is set
+    // to its size, 0 at end of file. For Mapped() it is the rest of file
+    const char *ViewBlock(size_t& len);
+    // same as feof(), true after reading past the end
+    bool Eof() const { return eofM; }
+
+    // true if data from View() points into mapped file and stays valid
+    // while this object exists
+    bool Mapped() const { return mapM != 0 && !compressedM; }
+    // offset of next byte and size of mapped file, only valid if Mapped()
+    size_t Tell() const { return (dataM - mapM) + posM; }
+    size_t Size() const { return mapSizeM; }
+
+    // data after this point is in compressed frames (see Compression.h)
+    void StartDecompression();
+    // true if compressed data was corrupt. It looks like end of file to readers
+    bool Failed() const { return failedM; }
+};
+
+#endif
@@ -0,0 +1,378 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : OutputSink.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Implementation of buffered output layer and its backends
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifdef IBPP_WINDOWS
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#define popen _popen
+#define pclose _pclose
+#endif
+
+#ifdef IBPP_LINUX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#define O_BINARY 0
+#define O_TEXT 0
+#endif
+
+#include <string.h>
+#include <thread>
+#include <condition_variable>
+#include "Compression.h"
+#include "OutputSink.h"
+
+OutputSink::OutputSink(size_t bufferSize)
+    : sizeM(bufferSize), usedM(0), atomicRowsM(false), failedM(false),
+    compressThreadsM(0), poolM(0)
+{
+    if (sizeM < OUTPUT_BUFFER_MINIMUM * 1024)
+        sizeM = OUTPUT_BUFFER_MINIMUM * 1024;
+    flushAtM = sizeM;
+    bufferM = new char[sizeM];
+}
+
+OutputSink::~OutputSink()
+{
+    StopCompression();
+    delete[] bufferM;
+}
+
+OutputSink *OutputSink::Open(const std::string& target, bool textMode, size_t bufferSize)
+{
+    if (target == "-")
+        return new FileSink(fileno(stdout), false, bufferSize);
+
+    if (target.length() > 1 && target[0] == '|')
+    {
+#ifdef IBPP_WINDOWS
+        FILE *p = popen(target.c_str() + 1, textMode ? "wt" : "wb");
+#else
+        FILE *p = popen(target.c_str() + 1, "w");
+#endif
+        if (!p)
+            return 0;
+        setvbuf(p, 0, _IONBF, 0);   // we do the buffering
+        return new PipeSink(p, bufferSize);
+    }
+
+#ifdef IBPP_WINDOWS
+    int fd = _open(target.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC
+        | (textMode ? _O_TEXT : _O_BINARY), _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+        | (textMode ? O_TEXT : O_BINARY), 0666);
+#endif
+    if (fd < 0)
+        return 0;
+    return new FileSink(fd, true, bufferSize);
+}
+
+void OutputSink::Grow(size_t len)
+{
+    size_t newSize = sizeM * 2;
+    while (newSize - usedM < len)
+        newSize *= 2;
+    char *temp = new char[newSize];
+    memcpy(temp, bufferM, usedM);
+    delete[] bufferM;
+    bufferM = temp;
+    sizeM = newSize;
+}
+
+void OutputSink::Write(const char *data, size_t len)
+{
+    if (atomicRowsM && sizeM - usedM < len)
+        Grow(len);
+    while (len > 0)
+    {
+        if (usedM == sizeM && !Flush())
+            return;
+        size_t chunk = sizeM - usedM;
+        if (chunk > len)
+            chunk = len;
+        memcpy(bufferM + usedM, data, chunk);
+        usedM += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+char *OutputSink::Reserve(size_t len)
+{
+    if (sizeM - usedM < len)
+    {
+        if (atomicRowsM)
+            Grow(len);
+        else
+            Flush();
+    }
+    return bufferM + usedM;
+}
+
+bool OutputSink::Flush()
+{
+    if (usedM > 0 && !failedM)
+    {
+        bool ok;
+        if (compressThreadsM)
+            ok = WriteCompressed(bufferM, usedM);
+        else
+            ok = WriteBlock(bufferM, usedM);
+        if (!ok)
+            failedM = true;
+    }
+    usedM = 0;      // on failure data is discarded, caller checks Failed()
+    return !failedM;
+}
+
+// helper threads of compression. Each flush is one job, helper number n
+// packs every step-th frame starting with frame n
+struct CompressPool
+{
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    unsigned job;               // incremented for each flush
+    size_t busy;                // helpers still packing current job
+    bool stop;
+    const char *data;
+    size_t len;
+    char *packed;
+    size_t bound;
+    size_t *sizes;
+    size_t step;
+};
+
+// packs every step-th frame, starting with frame first
+static void compressFrames(const char *data, size_t len, char *packed, size_t bound,
+    size_t *sizes, size_t first, size_t step)
+{
+    for (size_t f = first; f * COMPRESS_BLOCK_SIZE < len; f += step)
+    {
+        size_t start = f * COMPRESS_BLOCK_SIZE;
+        size_t frameLen = len - start;
+        if (frameLen > COMPRESS_BLOCK_SIZE)
+            frameLen = COMPRESS_BLOCK_SIZE;
+        sizes[f] = compressFrame(data + start, frameLen, packed + f * bound);
+    }
+}
+
+// thread function: waits for jobs until pool is stopped
+static void compressHelper(CompressPool *pool, size_t first)
+{
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> guard(pool->lock);
+    while (true)
+    {
+        while (pool->job == seen && !pool->stop)
+            pool->start.wait(guard);
+        if (pool->stop)
+            return;
+        seen = pool->job;
+        guard.unlock();
+        compressFrames(pool->data, pool->len, pool->packed, pool->bound,
+            pool->sizes, first, pool->step);
+        guard.lock();
+        if (--pool->busy == 0)
+            pool->done.notify_one();
+    }
+}
+
+void OutputSink::SetCompression(int threads)
+{
+    Flush();        // whatever was written so far is not compressed
+    StopCompression();
+    compressThreadsM = threads;
+    if (threads < 2)
+        return;
+    poolM = new CompressPool;
+    poolM->job = 0;
+    poolM->busy = 0;
+    poolM->stop = false;
+    for (int t = 1; t < threads; t++)
+        poolM->threads.push_back(std::thread(compressHelper, poolM, (size_t)t));
+}
+
+void OutputSink::StopCompression()
+{
+    if (!poolM)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(poolM->lock);
+        poolM->stop = true;
+    }
+    poolM->start.notify_all();
+    for (size_t t = 0; t < poolM->threads.size(); t++)
+        poolM->threads[t].join();
+    delete poolM;
+    poolM = 0;
+}
+
+bool OutputSink::WriteCompressed(const char *data, size_t len)
+{
+    size_t frames = (len + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE;
+    size_t bound = compressFrameBound(COMPRESS_BLOCK_SIZE);
+    if (packedM.size() < frames * bound)
+        packedM.resize(frames * bound);
+    std::vector<size_t> sizes(frames);
+
+    size_t step = compressThreadsM;
+    if (poolM && frames > 1)
+    {
+        {
+            std::lock_guard<std::mutex> guard(poolM->lock);
+            poolM->data = data;
+            poolM->len = len;
+            poolM->packed = &packedM[0];
+            poolM->bound = bound;
+            poolM->sizes = &sizes[0];
+            poolM->step = step;
+            poolM->busy = poolM->threads.size();
+            poolM->job++;
+        }
+        poolM->start.notify_all();
+    }
+    else
+        step = 1;
+    compressFrames(data, len, &packedM[0], bound, &sizes[0], 0, step);
+    if (step > 1)
+    {
+        std::unique_lock<std::mutex> guard(poolM->lock);
+        while (poolM->busy > 0)
+            poolM->done.wait(guard);
+    }
+
+    for (size_t f = 0; f < frames; f++)     // frames are written in order
+        if (!WriteBlock(&packedM[f * bound], sizes[f]))
+            return false;
+    return true;
+}
+
+bool OutputSink::Close()
+{
+    Flush();
+    if (!CloseBackend())
+        failedM = true;
+    return !failedM;
+}
+
+bool OutputSink::CloseBackend()
+{
+    return true;
+}
+
+FileSink::FileSink(int fd, bool owned, size_t bufferSize)
+    : OutputSink(bufferSize), fdM(fd), ownedM(owned)
+{
+}
+
+FileSink::~FileSink()
+{
+    CloseBackend();
+}
+
+bool FileSink::WriteBlock(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+#ifdef IBPP_WINDOWS
+        int written = _write(fdM, data, (unsigned int)len);
+#else
+        ssize_t written = write(fdM, data, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+#endif
+        if (written <= 0)
+            return false;
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+bool FileSink::CloseBackend()
+{
+    if (fdM < 0 || !ownedM)
+        return true;
+#ifdef IBPP_WINDOWS
+    int result = _close(fdM);
+#else
+    int result = close(fdM);
+#endif
+    fdM = -1;
+    return (result == 0);
+}
+
+SharedSink::SharedSink(OutputSink *target, std::mutex *lock, size_t bufferSize)
+    : OutputSink(bufferSize), targetM(target), lockM(lock)
+{
+    SetAtomicRows(true);
+}
+
+bool SharedSink::WriteBlock(const char *data, size_t len)
+{
+    std::lock_guard<std::mutex> guard(*lockM);
+    targetM->Write(data, len);
+    return !targetM->Failed();
+}
+
+StringSink::StringSink(size_t bufferSize)
+    : OutputSink(bufferSize)
+{
+}
+
+bool StringSink::WriteBlock(const char *data, size_t len)
+{
+    dataM.append(data, len);
+    return true;
+}
+
+PipeSink::PipeSink(FILE *pipe, size_t bufferSize)
+    : OutputSink(bufferSize), pipeM(pipe)
+{
+}
+
+PipeSink::~PipeSink()
+{
+    CloseBackend();
+}
+
+bool PipeSink::WriteBlock(const char *data, size_t len)
+{
+    return (fwrite(data, 1, len, pipeM) == len);
+}
+
+bool PipeSink::CloseBackend()
+{
+    if (!pipeM)
+        return true;
+    int status = pclose(pipeM);
+    pipeM = 0;
+    return (status == 0);
+}
@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : OutputSink.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Buffered output layer used by exporter. Values are encoded
+//                straight into a large reusable buffer which is flushed to
+//                the backend (file, stdout or pipe) in big writes.
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef OutputSinkH
+#define OutputSinkH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#define OUTPUT_BUFFER_DEFAULT   1024        // in KB
+#define OUTPUT_BUFFER_MINIMUM   64          // in KB, must hold a whole blob segment
+
+struct CompressPool;
+
+class OutputSink
+{
+private:
+    char *bufferM;
+    size_t sizeM;
+    size_t usedM;
+    size_t flushAtM;
+    bool atomicRowsM;
+    bool failedM;
+    int compressThreadsM;       // 0 = no compression
+    CompressPool *poolM;        // helper threads, 0 if compressed by one
+    std::vector<char> packedM;  // compressed frames
+
+    void Grow(size_t len);
+    bool WriteCompressed(const char *data, size_t len);
+    void StopCompression();
+
+    // no copying
+    OutputSink(const OutputSink&);
+    OutputSink& operator=(const OutputSink&);
+
+protected:
+    // backend: writes len bytes, returns false on error
+    virtual bool WriteBlock(const char *data, size_t len) = 0;
+    virtual bool CloseBackend();
+
+public:
+    OutputSink(size_t bufferSize);
+    virtual ~OutputSink();
+
+    // target: "-" = stdout, "|command" = pipe to command, anything else is
+    // a file name. Returns 0 if target cannot be opened
+    static OutputSink *Open(const std::string& target, bool textMode,
+        size_t bufferSize = OUTPUT_BUFFER_DEFAULT * 1024);
+
+    // when set, rows are never split between two writes to the backend:
+    // buffer grows if needed and it is only flushed at EndRow()
+    void SetAtomicRows(bool atomic) { atomicRowsM = atomic; }
+
+    // data written after this call is compressed. Each flush is split into
+    // frames (see Compression.h) which are packed by given number of threads.
+    // Helper threads are started here and kept until the sink is destroyed
+    void SetCompression(int threads);
+
+    inline void Put(unsigned char c)
+    {
+        if (usedM == sizeM)
+        {
+            if (atomicRowsM)
+                Grow(1);
+            else
+                Flush();
+        }
+        bufferM[usedM++] = (char)c;
+    }
+    void Write(const char *data, size_t len);
+    void Write(const std::string& s) { Write(s.data(), s.length()); }
+
+    // returns pointer to at least len free bytes in buffer (len <= buffer size)
+    // caller fills them in and calls Commit() with the number of bytes used
+    char *Reserve(size_t len);
+    void Commit(size_t len) { usedM += len; }
+
+    // marks the end of a row
+    inline void EndRow()
+    {
+        if (usedM >= flushAtM)
+            Flush();
+    }
+
+    bool Flush();
+    bool Close();
+    bool Failed() const { return failedM; }
+};
+
+// writes to file descriptor (regular file or stdout)
+class FileSink: public OutputSink
+{
+private:
+    int fdM;
+    bool ownedM;
+protected:
+    virtual bool WriteBlock(const char *data, size_t len);
+    virtual bool CloseBackend();
+public:
+    FileSink(int fd, bool owned, size_t bufferSize);
+    virtual ~FileSink();
+};
+
+// forwards whole rows to another sink shared by several threads
+class SharedSink: public OutputSink
+{
+private:
+    OutputSink *targetM;
+    std::mutex *lockM;
+protected:
+    virtual bool WriteBlock(const char *data, size_t len);
+public:
+    SharedSink(OutputSink *target, std::mutex *lock, size_t bufferSize);
+};
+
+// collects output in memory, used by encoder threads of export pipeline
+class StringSink: public OutputSink
+{
+private:
+    std::string dataM;
+protected:
+    virtual bool WriteBlock(const char *data, size_t len);
+public:
+    StringSink(size_t bufferSize);
+    std::string& Data() { return dataM; }   // call Flush() first
+};
+
+// feeds output to a shell command, i.e. -F "|gzip -c > data.fbx.gz"
+class PipeSink: public OutputSink
+{
+private:
+    FILE *pipeM;
+protected:
+    virtual bool WriteBlock(const char *data, size_t len);
+    virtual bool CloseBackend();
+public:
+    PipeSink(FILE *pipe, size_t bufferSize);
+    virtual ~PipeSink();
+};
+
+#endif
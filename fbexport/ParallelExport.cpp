@@ -0,0 +1,490 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : ParallelExport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Parallel export. Data is split into key ranges and each
+//                range is fetched over its own connection in its own thread
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifdef IBPP_LINUX
+#include <strings.h>
+#define strnicmp(a, b, c) strncasecmp( (a), (b), (c) )
+#endif
+
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <ctype.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+// one range of data, exported by one thread
+struct ExportJob
+{
+    int number;                 // 1..N, used in messages and shard names
+    string sql;                 // SELECT for this range
+    IBPP::Database db;          // own connection and transaction, started
+    IBPP::Transaction tr;       // by StartWorkers()
+    OutputSink *shared;         // merged output, or 0 if job writes a shard
+    std::mutex *lock;
+    int rows;                   // result, -1 on error
+};
+
+// quotes identifier or string literal: c is either " or '
+std::string quote(const std::string& s, char c)
+{
+    std::string q(1, c);
+    for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+    {
+        if (*it == c)
+            q += c;
+        q += *it;
+    }
+    return q + c;
+}
+
+// splits [lo, hi] into parts ranges of key. First range also takes NULLs
+// while the first and last range are left open, so no row is missed
+void splitKeyRange(int64_t lo, int64_t hi, int parts, const std::string& key,
+    std::vector<std::string>& conditions)
+{
+    uint64_t span = (uint64_t)hi - (uint64_t)lo + 1;
+    if (span != 0 && (uint64_t)parts > span)
+        parts = (int)span;
+    uint64_t step = (span == 0 ? UINT64_MAX / parts : span / parts);
+
+    int64_t start = lo;
+    for (int i = 0; i < parts; i++)
+    {
+        int64_t end = (int64_t)((uint64_t)start + step);
+        char from[30], to[30];
+        sprintf(from, "%lld", (long long)start);
+        sprintf(to, "%lld", (long long)end);
+        if (i == 0)
+            conditions.push_back(key + " < " + to + " OR " + key + " IS NULL");
+        else if (i == parts - 1)
+            conditions.push_back(key + " >= " + from);
+        else
+            conditions.push_back(key + " >= " + from + " AND " + key + " < " + to);
+        start = end;
+    }
+}
+
+// Splits the export into ar->Workers ranges, each given as complete SELECT
+// statement. For verbatim export (-V) table is split by its primary key if it
+// is a single integer column, otherwise by RDB$DB_KEY ranges of pointer pages.
+// Free queries (-Q) are wrapped into derived table and split by their first
+// column if it is an integer. Returns false if data cannot be split.
+bool FBExport::PlanRanges(IBPP::Transaction& tr, IBPP::Statement& st,
+    std::vector<std::string>& ranges)
+{
+    IBPP::Statement meta = IBPP::StatementFactory(st->DatabasePtr(), tr);
+    std::vector<std::string> conditions;
+    std::string head, tail;
+
+    if (ar->VerbatimCopyTable != "")
+    {
+        // user's where clause is ANDed to range condition
+        std::string where(VerbatimWhere);
+        where.erase(0, where.find_first_not_of(" \t\r\n"));
+        if (where != "")
+        {
+            if (where.length() < 6 || strnicmp(where.c_str(), "WHERE", 5) != 0
+                || !isspace(where[5]))
+            {
+                return false;
+            }
+            tail = " AND (" + where.substr(6) + ")";
+        }
+        head = "SELECT " + VerbatimColumns + " FROM " + ar->VerbatimCopyTable + " WHERE (";
+
+        meta->Prepare(
+            "select s.rdb$field_name "
+            "from rdb$relation_constraints c "
+            "join rdb$index_segments s on s.rdb$index_name = c.rdb$index_name "
+            "where c.rdb$relation_name = ? and c.rdb$constraint_type = 'PRIMARY KEY'");
+        meta->Set(1, ar->VerbatimCopyTable);
+        meta->Execute();
+        std::vector<std::string> pk;
+        while (meta->Fetch())
+        {
+            std::string temp;
+            meta->Get(1, temp);
+            temp.erase(temp.find_last_not_of(' ')+1);   // trim
+            pk.push_back(Dialect == 1 ? temp : quote(temp, '"'));
+        }
+
+        if (pk.size() == 1)
+        {
+            meta->Prepare("SELECT MIN(" + pk[0] + "), MAX(" + pk[0] + ") FROM "
+                + ar->VerbatimCopyTable);
+            IBPP::SDT type = meta->ColumnType(1);
+            if ((type == IBPP::sdSmallint || type == IBPP::sdInteger
+                || type == IBPP::sdLargeint) && meta->ColumnScale(1) == 0)
+            {
+                meta->Execute();
+                meta->Fetch();
+                if (meta->IsNull(1))        // empty table
+                    return false;
+                int64_t lo, hi;
+                meta->Get(1, lo);
+                meta->Get(2, hi);
+                Printf("Splitting by primary key %s.\n", pk[0].c_str());
+                splitKeyRange(lo, hi, ar->Workers, pk[0], conditions);
+            }
+        }
+
+        if (conditions.empty())     // no usable primary key, use DB_KEY
+        {
+            meta->Prepare(
+                "select max(p.rdb$page_sequence) "
+                "from rdb$pages p "
+                "join rdb$relations r on r.rdb$relation_id = p.rdb$relation_id "
+                "where r.rdb$relation_name = ? and p.rdb$page_type = 4");
+            meta->Set(1, ar->VerbatimCopyTable);
+            meta->Execute();
+            meta->Fetch();
+            if (meta->IsNull(1))
+                return false;
+            int pages;
+            meta->Get(1, pages);
+            pages++;                // sequence starts at 0
+            int parts = (pages < ar->Workers ? pages : ar->Workers);
+            if (parts < 2)
+                return false;
+
+            Printf("Splitting by RDB$DB_KEY, %d pointer pages.\n", pages);
+            std::string table = quote(ar->VerbatimCopyTable, '\'');
+            for (int i = 0; i < parts; i++)
+            {
+                char from[20], to[20];
+                sprintf(from, "%d", (int)((int64_t)pages * i / parts));
+                sprintf(to, "%d", (int)((int64_t)pages * (i + 1) / parts));
+                std::string cond;
+                if (i > 0)
+                    cond = "RDB$DB_KEY >= MAKE_DBKEY(" + table + ", 0, 0, " + from + ")";
+                if (i < parts - 1)
+                {
+                    cond += (cond == "" ? "" : " AND ");
+                    cond += "RDB$DB_KEY < MAKE_DBKEY(" + table + ", 0, 0, " + to + ")";
+                }
+                conditions.push_back(cond);
+            }
+        }
+    }
+    else
+    {
+        // derived table keeps original column names, so they must be unique
+        IBPP::SDT type = st->ColumnType(1);
+        if (Dialect == 1 || ar->ExportFormat == xefInserts || st->ColumnScale(1) != 0
+            || (type != IBPP::sdSmallint && type != IBPP::sdInteger
+                && type != IBPP::sdLargeint))
+        {
+            return false;
+        }
+
+        std::string columns;
+        for (int i = 1; i <= st->Columns(); i++)
+        {
+            if (i > 1)
+                columns += ",";
+            columns += quote(st->ColumnAlias(i), '"');
+        }
+        std::string sql(ar->SQL);
+        sql.erase(sql.find_last_not_of(" \t\r\n;")+1);
+        std::string derived = "(" + sql + ") FBX$RANGE (" + columns + ")";
+        std::string key = quote(st->ColumnAlias(1), '"');
+
+        meta->Prepare("SELECT MIN(" + key + "), MAX(" + key + ") FROM " + derived);
+        meta->Execute();
+        meta->Fetch();
+        if (meta->IsNull(1))
+            return false;
+        int64_t lo, hi;
+        meta->Get(1, lo);
+        meta->Get(2, hi);
+        Printf("Splitting by column %s.\n", key.c_str());
+        splitKeyRange(lo, hi, ar->Workers, key, conditions);
+        head = "SELECT * FROM " + derived + " WHERE (";
+    }
+
+    if (conditions.size() < 2)
+        return false;
+
+    for (std::vector<std::string>::iterator it = conditions.begin(); it != conditions.end(); ++it)
+    {
+        std::string sql = head + *it + ")" + tail;
+        meta->Prepare(sql);         // make sure it is valid before we start
+        ranges.push_back(sql);
+    }
+    return true;
+}
+
+// thread function, exports one range over its own connection
+void FBExport::ExportWorker(ExportJob *job)
+{
+    OutputSink *out = 0;
+    try
+    {
+        IBPP::Statement st = IBPP::StatementFactory(job->db, job->tr);
+        st->Prepare(job->sql);
+        st->Execute();
+
+        if (job->shared)
+            out = new SharedSink(job->shared, job->lock, ar->OutputBuffer * 1024);
+        else
+        {
+            // shard: file name has %d in it, replaced with range number
+            std::string name(ar->Filename);
+            char num[20];
+            sprintf(num, "%d", job->number);
+            name.replace(name.find("%d"), 2, num);
+            out = OutputSink::Open(name, ar->ExportFormat != xefDefault,
+                ar->OutputBuffer * 1024);
+            if (!out)
+            {
+                Printf("Cannot open file: %s for writing.\n", name.c_str());
+                job->rows = -1;
+                return;
+            }
+            if (ar->ExportFormat == xefDefault)
+                ExportHeader(st, *out);
+            else
+                ExportHumanHeader(st, *out);
+        }
+
+        if (ar->ExportFormat == xefDefault)
+            job->rows = ExportRows(st, *out, job->number);
+        else
+            job->rows = ExportHumanRows(st, *out, job->number);
+
+        if (!job->shared && job->rows >= 0)
+            ExportHumanFooter(*out);
+        if (!out->Close() && job->rows >= 0)
+        {
+            Printf("Worker %d cannot write output.\n", job->number);
+            job->rows = -1;
+        }
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("Worker %d error: %s\n", job->number, e.ErrorMessage());
+        job->rows = -1;
+    }
+    catch (std::exception &e)
+    {
+        Printf("Worker %d error: %s\n", job->number, e.what());
+        job->rows = -1;
+    }
+    delete out;
+}
+
+// Connects all workers and starts their transactions, so they all see the
+// same data as transaction tr. On Firebird 4 and up they share its snapshot,
+// with older servers tables are reserved (no one can write to them) while
+// workers are starting. Returns false on error
+bool FBExport::StartWorkers(IBPP::Database& db, IBPP::Transaction& tr,
+    const std::set<std::string>& tables, std::vector<ExportJob>& jobs)
+{
+    try
+    {
+        for (std::vector<ExportJob>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+        {
+            it->db = IBPP::DatabaseFactory(db->ServerName(), db->DatabaseName(),
+                db->Username(), db->UserPassword(), db->RoleName(), db->CharSet(), "");
+            it->db->Connect();
+            it->tr = IBPP::TransactionFactory(it->db, IBPP::amRead);
+        }
+
+        int64_t snapshot = 0;
+        try
+        {
+            snapshot = tr->SnapshotNumber();
+        }
+        catch (IBPP::Exception &)   // client library too old
+        {
+        }
+
+        IBPP::Transaction guard;
+        if (snapshot)
+        {
+            Printf("Workers share snapshot number %lld.\n", (long long)snapshot);
+            for (std::vector<ExportJob>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+                it->tr->AtSnapshotNumber(it->db, snapshot);
+        }
+        else if (!tables.empty())
+        {
+            Printf("Locking tables for consistent start of workers...");
+            guard = IBPP::TransactionFactory(db, IBPP::amRead);
+            for (std::set<std::string>::const_iterator it = tables.begin(); it != tables.end(); ++it)
+                guard->AddReservation(db, *it, IBPP::trProtectedRead);
+            guard->Start();     // waits for pending writers
+            Printf("Done.\n");
+        }
+        else
+            Printf("WARNING: Workers might not see the same data.\n");
+
+        for (std::vector<ExportJob>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+            it->tr->Start();
+        if (guard.intf())
+            guard->Commit();
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+        return false;
+    }
+    return true;
+}
+
+// exports over ar->Workers connections. If ar->Filename contains %d, each
+// range is written to its own file (shard), otherwise rows of all ranges are
+// merged into a single output, in no particular order
+// returns: # of rows exported, -1 on error, -2 if data cannot be split
+int FBExport::ExportParallel(IBPP::Database& db, IBPP::Transaction& tr,
+    IBPP::Statement& st)
+{
+    std::vector<std::string> ranges;
+    try
+    {
+        if (!PlanRanges(tr, st, ranges))
+            ranges.clear();
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+        ranges.clear();
+    }
+    if (ranges.size() < 2)
+    {
+        Printf("Cannot split data into ranges, using single connection.\n");
+        return -2;
+    }
+
+    bool shards = (ar->Filename.find("%d") != string::npos);
+    Printf("Exporting data in %d ranges%s...\n", (int)ranges.size(),
+        shards ? ", one file per range" : "");
+    time_t StartTime;
+    time(&StartTime);
+
+    OutputSink *out = 0;
+    std::mutex lock;
+    if (!shards)
+    {
+        out = OutputSink::Open(ar->Filename, ar->ExportFormat != xefDefault,
+            ar->OutputBuffer * 1024);
+        if (!out)
+        {
+            Printf("Cannot open file: %s for writing.\n", ar->Filename.c_str());
+            return -1;
+        }
+        if (ar->ExportFormat == xefDefault)
+            ExportHeader(st, *out);
+        else
+            ExportHumanHeader(st, *out);
+    }
+
+    // tables which are locked if snapshot cannot be shared
+    std::set<std::string> tables;
+    if (ar->VerbatimCopyTable != "")
+        tables.insert(ar->VerbatimCopyTable);
+    else
+    {
+        for (int i = 1; i <= st->Columns(); i++)
+            if (*st->ColumnTable(i))
+                tables.insert(st->ColumnTable(i));
+    }
+
+    std::vector<ExportJob> jobs(ranges.size());
+    if (!StartWorkers(db, tr, tables, jobs))
+    {
+        delete out;
+        return -1;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        jobs[i].number = (int)i + 1;
+        jobs[i].sql = ranges[i];
+        jobs[i].shared = out;
+        jobs[i].lock = &lock;
+        jobs[i].rows = -1;
+        threads.push_back(std::thread(&FBExport::ExportWorker, this, &jobs[i]));
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+        try
+        {
+            jobs[i].tr->Commit();
+            jobs[i].db->Disconnect();
+        }
+        catch (IBPP::Exception &e)
+        {
+            Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+        }
+        if (jobs[i].rows < 0)
+            ret = -1;
+        else if (ret >= 0)
+        {
+            Printf("Worker %d exported %d rows.\n", jobs[i].number, jobs[i].rows);
+            ret += jobs[i].rows;
+        }
+    }
+
+    if (out)
+    {
+        if (ret >= 0)
+            ExportHumanFooter(*out);
+        if (!out->Close() && ret >= 0)
+        {
+            Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+            ret = -1;
+        }
+        delete out;
+    }
+    if (ret < 0)
+        return -1;
+
+    time_t EndTime;
+    time(&EndTime);
+    Printf("\nStart   : %s", ctime(&StartTime));
+    Printf("End     : %s",   ctime(&EndTime));
+    Printf("Elapsed : %d seconds.\n",  (EndTime - StartTime));
+    return ret;
+}
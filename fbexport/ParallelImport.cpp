@@ -0,0 +1,264 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : ParallelImport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Import of fbx file over several connections. File is
+//                split into ranges of whole rows (or blocks of columnar
+//                layout) and each range is inserted by its own thread
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+// one range of input file, imported by one thread
+struct ImportJob
+{
+    int number;                 // 1..N, used in messages
+    size_t from;                // offsets of range in file
+    size_t to;
+    IBPP::Database db;          // own connection and transaction
+    IBPP::Transaction tr;
+    atomic<int> *errors;        // shared by all jobs, for -E
+    bool failed;                // some rows could not be imported
+    int rows;                   // result, -1 on error
+};
+
+// skips one row of row layout, returns false at end of file or if the
+// row is not complete
+bool FBExport::SkipRow(InputSource& in, IBPP::SDT *ft)
+{
+    for (int i=0; i<fieldcount; i++)
+    {
+        int size = in.Get();
+        if (size == EOF)
+            return false;
+        if (ft[i] == IBPP::sdBlob)
+        {
+            if (size == 0)      // null
+                continue;
+            while (true)
+            {
+                const char *temp = in.View(4);
+                int len = (temp ? segmentLength(temp) : -1);
+                if (len < 0)
+                    return false;
+                if (len == 0)
+                    break;
+                if (!in.View(len))
+                    return false;
+            }
+            continue;
+        }
+        if (size == 255)        // null
+            continue;
+        if (size == 254)
+        {
+            int first = in.Get();
+            int second = in.Get();
+            size = first * 256 + second;
+        }
+        if (size < 0 || !in.View(size))
+            return false;
+    }
+    return true;
+}
+
+// skips one block of columnar layout, returns false at end of file or if
+// the block is not complete
+bool FBExport::SkipBlock(InputSource& in)
+{
+    if (!in.View(4))
+        return false;
+    for (int i=0; i<fieldcount; i++)
+    {
+        const char *head = in.View(5);
+        if (!head || !in.View((uint32_t)decodeLE(head + 1, 4)))
+            return false;
+    }
+    return true;
+}
+
+// Finds where to split the rest of mapped file into ar->Workers ranges of
+// about the same size. Ranges start at rows (or blocks), cuts gets offsets
+// of their starts and the end of file. Returns false if there are less
+// than two ranges
+bool FBExport::SplitInput(InputSource& in, IBPP::SDT *ft, vector<size_t>& cuts)
+{
+    size_t start = in.Tell();
+    size_t size = in.Size() - start;
+    InputSource scan(in, start, in.Size());
+    bool columnar = ((FileFlags & FBX_FLAG_COLUMNAR) != 0);
+
+    cuts.push_back(start);
+    size_t next = size / ar->Workers;
+    while ((int)cuts.size() < ar->Workers)
+    {
+        size_t pos = scan.Tell();
+        if (pos >= next && pos > cuts.back() - start)
+        {
+            cuts.push_back(start + pos);
+            next = size / ar->Workers * cuts.size();
+        }
+        // a broken row is left to the last range, so it gets reported
+        if (!(columnar ? SkipBlock(scan) : SkipRow(scan, ft)))
+            break;
+    }
+    cuts.push_back(start + size);
+    if (cuts[cuts.size() - 2] == cuts.back())   // nothing after last cut
+        cuts.pop_back();
+    return (cuts.size() > 2);
+}
+
+// thread function, imports one range over its own connection. It works on
+// a copy of this object, so that data of current row is not shared
+void FBExport::ImportWorker(ImportJob *job, InputSource *in, IBPP::SDT *ft)
+{
+    FBExport worker(*this);
+    worker.Worker = job->number;
+    worker.SharedErrors = job->errors;
+    worker.WereErrors = false;
+    ImportBatch *batch = 0;
+    try
+    {
+        InputSource part(*in, job->from, job->to);
+        IBPP::Statement st = IBPP::StatementFactory(job->db, job->tr);
+        st->Prepare(ar->SQL);
+        if (ar->Batch > 1)
+            batch = worker.PrepareBatch(st);
+        if (FileFlags & FBX_FLAG_COLUMNAR)
+            job->rows = worker.ImportBlocks(st, part, ft, batch);
+        else
+            job->rows = worker.ImportRows(st, part, ft, batch);
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("Worker %d error: %s\n", job->number, e.ErrorMessage());
+        job->rows = -1;
+    }
+    catch (std::exception &e)
+    {
+        Printf("Worker %d error: %s\n", job->number, e.what());
+        job->rows = -1;
+    }
+    delete batch;
+    job->failed = worker.WereErrors;
+}
+
+// imports over ar->Workers connections, each with its own transaction.
+// They are committed when all are done, or all rolled back with -R if any
+// row failed
+// returns: # of rows imported, -1 on error, -2 if file cannot be split
+int FBExport::ImportParallel(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft)
+{
+    vector<size_t> cuts;
+    if (!in.Mapped() || !SplitInput(in, ft, cuts))
+    {
+        Printf("Cannot split input into ranges, using single connection.\n");
+        return -2;
+    }
+
+    atomic<int> errors(0);
+    vector<ImportJob> jobs(cuts.size() - 1);
+    IBPP::Database db = st->DatabasePtr();
+    try
+    {
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            jobs[i].number = (int)i + 1;
+            jobs[i].from = cuts[i];
+            jobs[i].to = cuts[i + 1];
+            jobs[i].errors = &errors;
+            jobs[i].failed = false;
+            jobs[i].rows = -1;
+            jobs[i].db = IBPP::DatabaseFactory(db->ServerName(), db->DatabaseName(),
+                db->Username(), db->UserPassword(), db->RoleName(), db->CharSet(), "");
+            jobs[i].db->Connect();
+            if (ar->NoAutoUndo)
+                jobs[i].tr = IBPP::TransactionFactory(jobs[i].db, IBPP::amWrite,
+                    IBPP::ilConcurrency, IBPP::lrWait, IBPP::tfNoAutoUndo);
+            else
+                jobs[i].tr = IBPP::TransactionFactory(jobs[i].db, IBPP::amWrite);
+            jobs[i].tr->Start();
+        }
+    }
+    catch (IBPP::Exception &e)
+    {
+        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+        Printf("Cannot connect workers, using single connection.\n");
+        return -2;
+    }
+    Printf("Importing data in %d ranges...\n", (int)jobs.size());
+
+    vector<std::thread> threads;
+    for (size_t i = 0; i < jobs.size(); i++)
+        threads.push_back(std::thread(&FBExport::ImportWorker, this, &jobs[i], &in, ft));
+
+    int ret = 0;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+        if (jobs[i].failed)
+            WereErrors = true;
+        if (jobs[i].rows < 0)
+            ret = -1;
+        else if (ret >= 0)
+        {
+            Printf("Worker %d imported %d rows.\n", jobs[i].number, jobs[i].rows);
+            ret += jobs[i].rows;
+        }
+    }
+
+    bool rollback = (ar->Rollback && WereErrors);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        try
+        {
+            if (rollback)
+                jobs[i].tr->Rollback();
+            else
+                jobs[i].tr->Commit();
+            jobs[i].db->Disconnect();
+        }
+        catch (IBPP::Exception &e)
+        {
+            Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+            ret = -1;
+        }
+    }
+    Printf("Transactions of workers %s.\n", rollback ? "rolled back" : "commited");
+    if (errors > 0)
+        Printf("%d rows failed.\n", (int)errors);
+    return ret;
+}
@@ -32,12 +32,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <thread>
 #pragma hdrstop
 #include "ParseArgs.h"
 #include "FBExport.h"
+#include "BulkLoad.h"
 
 Arguments::Arguments()
 {
+    OutputBuffer = OUTPUT_BUFFER_DEFAULT;
+    Workers = 1;
+    Encoders = 0;
+    FileVersion = FBEXPORT_FILE_VERSION;
+    Columnar = false;
+    Compress = 0;
+    Batch = 0;
+    Bulk = false;
+    BulkTriggers = false;
+    Journal = BULK_JOURNAL_DEFAULT;
+    StmtCache = 0;
     Operation = xopNone;
     Error = "OK";
 }
@@ -55,6 +69,17 @@ Arguments::Arguments(int argc, char **argv)
     ExportFormat = xefDefault;
     CheckPoint = 1000;  // default values (public)
     IgnoreErrors = 0;
+    OutputBuffer = OUTPUT_BUFFER_DEFAULT;
+    Workers = 1;
+    Encoders = 0;
+    FileVersion = FBEXPORT_FILE_VERSION;
+    Columnar = false;
+    Compress = 0;
+    Batch = 0;
+    Bulk = false;
+    BulkTriggers = false;
+    Journal = BULK_JOURNAL_DEFAULT;
+    StmtCache = 0;
     Rollback = false;
     TrimChars = false;
     NoAutoUndo = false;
@@ -93,6 +118,13 @@ Arguments::Arguments(int argc, char **argv)
             return;
         }
 
+        if (argv[p][1] == '-')          // --option or --option=value
+        {
+            if (!ParseLongOption(argv[p] + 2))
+                return;
+            continue;
+        }
+
         char c = argv[p][1];            // allow uppercase/lowercase
         if (c >= 'a' && c <= 'z')
             c += 'A' - 'a';
@@ -146,6 +178,8 @@ Arguments::Arguments(int argc, char **argv)
             case 'I': Operation = xopInsert;
                 if (argv[p][2] == 'f')
                     Operation = xopInsertFull;
+                if (argv[p][2] == 'c' || (argv[p][2] == 'f' && argv[p][3] == 'c'))
+                    ExportFormat = xefCSV;      // -Ic, -Ifc
                 break;
             case 'J': DateFormat = arg;                 break;
             case 'K': TimeFormat = arg;                 break;
@@ -163,6 +197,8 @@ Arguments::Arguments(int argc, char **argv)
                     ExportFormat = xefCSV;
                 else if (argv[p][2] == 'h')
                     ExportFormat = xefHTML;
+                else if (argv[p][2] == 'b')
+                    Columnar = true;
                 break;
             case 'T': TrimChars = true;                 break;
             case 'U': Username = arg;                   break;
@@ -180,4 +216,126 @@ Arguments::Arguments(int argc, char **argv)
         Error = "You must specify operation switch. (S, I, X or L).";
 }
 
+// tuning options, there are not enough letters left for those
+bool Arguments::ParseLongOption(const string& option)
+{
+    string name(option), value;
+    string::size_type eq = option.find('=');
+    if (eq != string::npos)
+    {
+        name = option.substr(0, eq);
+        value = option.substr(eq + 1);
+    }
+    for (string::iterator it = name.begin(); it != name.end(); it++)
+        *it = ::tolower(*it);
+
+    if (name == "buffer")
+    {
+        OutputBuffer = atoi(value.c_str());
+        if (OutputBuffer < OUTPUT_BUFFER_MINIMUM)
+        {
+            Error = "Option --buffer needs a size in KB (minimum 64).";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "workers")
+    {
+        Workers = atoi(value.c_str());
+        if (Workers < 1)
+        {
+            Error = "Option --workers needs a number of connections.";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "encoders")
+    {
+        if (value == "")
+            Encoders = std::thread::hardware_concurrency();
+        else
+            Encoders = atoi(value.c_str());
+        if (Encoders < 1)
+            Encoders = 1;
+        return true;
+    }
+
+    if (name == "file-version")
+    {
+        FileVersion = atoi(value.c_str());
+        if (FileVersion != FBEXPORT_FILE_VERSION
+            && FileVersion != FBEXPORT_FILE_VERSION_TEXT)
+        {
+            Error = "Option --file-version can only be 180 or 190.";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "compress")
+    {
+        if (value == "")
+            Compress = std::thread::hardware_concurrency();
+        else
+            Compress = atoi(value.c_str());
+        if (Compress < 1)
+            Compress = 1;
+        return true;
+    }
+
+    if (name == "batch")
+    {
+        if (value == "")
+            Batch = BATCH_MAX_ROWS;
+        else
+            Batch = atoi(value.c_str());
+        if (Batch < 1)
+        {
+            Error = "Option --batch needs a number of rows.";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "bulk")
+    {
+        Bulk = true;
+        if (value == "triggers")
+            BulkTriggers = true;
+        else if (value != "")
+        {
+            Error = "Option --bulk only takes value: triggers.";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "journal")
+    {
+        Journal = value;
+        if (Journal == "")
+        {
+            Error = "Option --journal needs a file name.";
+            return false;
+        }
+        return true;
+    }
+
+    if (name == "stmt-cache")
+    {
+        StmtCache = atoi(value.c_str());
+        if (StmtCache < 1)
+        {
+            Error = "Option --stmt-cache needs a number of statements.";
+            return false;
+        }
+        return true;
+    }
+
+    Error = "Unknown switch --" + name;
+    return false;
+}
+
 #pragma package(smart_init)
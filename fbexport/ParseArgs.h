@@ -49,6 +49,7 @@ typedef enum { xefDefault, xefCSV, xefInserts, xefHTML  } XExportFormat;
 class Arguments
 {
 private:
+    bool ParseLongOption(const string& option);
 public:
     string Username;
     string Role;
@@ -64,12 +65,23 @@ public:
     string Separator;
     int CheckPoint;
     int IgnoreErrors;
+    int OutputBuffer;   // in KB
+    int Workers;
+    int Encoders;       // encoder threads of export pipeline, 0 = no pipeline
+    int FileVersion;    // of fbx files written
+    bool Columnar;      // write fbx in columnar layout (-Sb)
+    int Compress;       // number of compression threads, 0 = off
+    int Batch;          // rows per EXECUTE BLOCK on import, 0 = row by row
+    bool Bulk;          // deactivate indexes of target table for import
+    bool BulkTriggers;  // and its triggers too
+    string Journal;     // of bulk load, see BulkLoad.h
+    int StmtCache;      // prepared statements kept by -X, 0 = none
     bool Rollback;
     bool TrimChars;
     bool NoAutoUndo;
     bool CommitOnCheckpoint;
     XOperation Operation;
-    XExportFormat ExportFormat;
+    XExportFormat ExportFormat;     // also of imported file, only CSV is read
 
     string Error;       // if not "OK" - error text
 
@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : PipelineExport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Export pipeline. Rows are fetched, encoded and written
+//                out by separate threads, in the order they were fetched
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+#define PIPELINE_BATCH_ROWS 256     // rows passed between threads at once
+#define PIPELINE_DEPTH 4            // batches in flight, per encoder thread
+
+// rows fetched together, encoded by one encoder thread
+struct RowBatch
+{
+    int sequence;               // batches are written in this order
+    int rows;
+    vector<IBPP::Row> row;      // each has its own copy of the fetched data
+    vector<string> blobs;       // contents of blob columns, columns+1 per row
+    string data;                // encoded rows
+};
+
+// state shared by fetch, encoder and writer threads
+struct ExportPipe
+{
+    std::mutex lock;
+    std::condition_variable fetched;    // batch added to todo, or fetch ended
+    std::condition_variable encoded;    // batch added to done
+    std::condition_variable written;    // batch written, room for a new one
+    std::deque<RowBatch *> todo;
+    std::map<int, RowBatch *> done;     // waiting for batches before them
+    int inFlight;               // batches fetched but not written yet
+    int batches;                // total number, set when fetching ends
+    bool fetching;
+    bool failed;                // tells all threads to stop
+
+    bool human;                 // CSV, INSERT or HTML
+    vector<IBPP::SDT> types;
+    HumanLayout layout;
+};
+
+// encoder thread: takes batches in any order and encodes them
+void FBExport::EncodeBatches(ExportPipe *pipe)
+{
+    StringSink sink(OUTPUT_BUFFER_MINIMUM * 1024);
+    string value;
+    size_t width = pipe->types.size();
+    while (true)
+    {
+        RowBatch *batch;
+        {
+            std::unique_lock<std::mutex> guard(pipe->lock);
+            while (pipe->todo.empty() && pipe->fetching && !pipe->failed)
+                pipe->fetched.wait(guard);
+            if (pipe->todo.empty() || pipe->failed)
+                return;
+            batch = pipe->todo.front();
+            pipe->todo.pop_front();
+        }
+
+        bool ok = true;
+        try
+        {
+            for (int r = 0; r < batch->rows; r++)
+            {
+                const string *blobs = (batch->blobs.empty() ? 0 : &batch->blobs[r * width]);
+                if (pipe->human)
+                    EncodeHumanRow(sink, batch->row[r], pipe->layout, value, blobs);
+                else
+                    EncodeRow(sink, batch->row[r], pipe->types, value, blobs);
+            }
+            sink.Flush();
+            batch->data.swap(sink.Data());
+            sink.Data().erase();
+        }
+        catch (IBPP::Exception &e)
+        {
+            Printf("Encoder error: %s\n", e.ErrorMessage());
+            ok = false;
+        }
+        catch (std::exception &e)
+        {
+            Printf("Encoder error: %s\n", e.what());
+            ok = false;
+        }
+        batch->row.clear();     // rows are released in this thread
+        batch->blobs.clear();
+
+        std::lock_guard<std::mutex> guard(pipe->lock);
+        pipe->done[batch->sequence] = batch;
+        if (!ok)
+        {
+            pipe->failed = true;
+            pipe->fetched.notify_all();
+            pipe->written.notify_all();
+        }
+        pipe->encoded.notify_all();
+    }
+}
+
+// writer thread: the only one that writes to output after the header.
+// Batches are written in the order they were fetched
+void FBExport::WriteBatches(ExportPipe *pipe, OutputSink *out)
+{
+    int rows = 0;
+    for (int next = 0; ; next++)
+    {
+        RowBatch *batch;
+        {
+            std::unique_lock<std::mutex> guard(pipe->lock);
+            while (!pipe->failed && pipe->done.find(next) == pipe->done.end()
+                && (pipe->fetching || next < pipe->batches))
+            {
+                pipe->encoded.wait(guard);
+            }
+            if (pipe->failed || pipe->done.find(next) == pipe->done.end())
+                return;     // error, or all batches are written
+            batch = pipe->done[next];
+            pipe->done.erase(next);
+        }
+
+        out->Write(batch->data);
+        out->EndRow();      // buffer is flushed in big blocks
+        bool ok = !out->Failed();
+        if (!ok)
+            Printf("Cannot write file: %s.\n", ar->Filename.c_str());
+
+        // print checkpoints (exporting, no commit needed)
+        for (int r = rows; ok && r < rows + batch->rows; r++)
+            if (r % ar->CheckPoint == 0 && r)
+                Printf("Checkpoint at: %d lines.\n", r);
+        rows += batch->rows;
+        delete batch;
+
+        std::lock_guard<std::mutex> guard(pipe->lock);
+        pipe->inFlight--;
+        if (!ok)
+        {
+            pipe->failed = true;
+            pipe->fetched.notify_all();
+            pipe->encoded.notify_all();
+        }
+        pipe->written.notify_all();
+        if (!ok)
+            return;
+    }
+}
+
+// tells encoder and writer threads that there are no more batches, waits
+// for them to finish and deletes what is left over
+static void stopPipe(ExportPipe& pipe, int batches, std::vector<std::thread>& threads)
+{
+    {
+        std::lock_guard<std::mutex> guard(pipe.lock);
+        pipe.fetching = false;
+        pipe.batches = batches;
+        pipe.fetched.notify_all();
+        pipe.encoded.notify_all();
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    for (size_t i = 0; i < pipe.todo.size(); i++)
+        delete pipe.todo[i];
+    for (std::map<int, RowBatch *>::iterator it = pipe.done.begin(); it != pipe.done.end(); ++it)
+        delete it->second;
+}
+
+// statement is executed. This thread fetches rows in batches, encoder threads
+// encode them into fbx (or CSV, INSERT, HTML if human is set) and writer thread
+// writes them out, so waiting for server and formatting of data overlap.
+// Blobs are read here, as their handles belong to the fetching transaction.
+// returns: # of rows exported, -1 on error
+int FBExport::ExportPipeline(IBPP::Statement& st, OutputSink& out, bool human)
+{
+    ExportPipe pipe;
+    pipe.inFlight = 0;
+    pipe.batches = 0;
+    pipe.fetching = true;
+    pipe.failed = false;
+    pipe.human = human;
+    FileTypes(st, pipe.types);
+    if (human)
+        HumanRowLayout(st, pipe.layout);
+
+    size_t width = pipe.types.size();
+    vector<int> blobColumns;
+    for (size_t i = 1; i < width; i++)
+        if (pipe.types[i] == IBPP::sdBlob)
+            blobColumns.push_back(i);
+
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(&FBExport::WriteBatches, this, &pipe, &out));
+    for (int i = 0; i < ar->Encoders; i++)
+        threads.push_back(std::thread(&FBExport::EncodeBatches, this, &pipe));
+
+    int ret = 0;
+    int sequence = 0;
+    try
+    {
+        bool more = true;
+        while (more)
+        {
+            {
+                std::unique_lock<std::mutex> guard(pipe.lock);
+                while (pipe.inFlight >= ar->Encoders * PIPELINE_DEPTH && !pipe.failed)
+                    pipe.written.wait(guard);
+                if (pipe.failed)
+                    break;
+            }
+
+            RowBatch *batch = new RowBatch;
+            batch->sequence = sequence;
+            batch->rows = 0;
+            batch->row.resize(PIPELINE_BATCH_ROWS);
+            while (batch->rows < PIPELINE_BATCH_ROWS
+                && (more = st->Fetch(batch->row[batch->rows])))
+            {
+                if (!blobColumns.empty())
+                {
+                    IBPP::Row& row = batch->row[batch->rows];
+                    batch->blobs.resize((batch->rows + 1) * width);
+                    string *blobs = &batch->blobs[batch->rows * width];
+                    for (size_t i = 0; i < blobColumns.size(); i++)
+                        if (!row->IsNull(blobColumns[i]))
+                            row->Get(blobColumns[i], blobs[blobColumns[i]]);
+                }
+                batch->rows++;
+            }
+            if (batch->rows == 0)
+            {
+                delete batch;
+                break;
+            }
+            ret += batch->rows;
+
+            std::lock_guard<std::mutex> guard(pipe.lock);
+            pipe.todo.push_back(batch);
+            pipe.inFlight++;
+            sequence++;
+            pipe.fetched.notify_one();
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> guard(pipe.lock);
+            pipe.failed = true;
+        }
+        stopPipe(pipe, sequence, threads);
+        throw;
+    }
+
+    stopPipe(pipe, sequence, threads);
+    if (pipe.failed)
+        return -1;
+    return ret;
+}
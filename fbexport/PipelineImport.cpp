@@ -0,0 +1,432 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : PipelineImport.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Import with separate reader thread, which decodes rows
+//                of fbx file while the statement is being executed
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+
+#define IMPORT_PIPE_ROWS    256         // rows decoded at once
+#define IMPORT_PIPE_DEPTH   4           // batches in the ring
+#define IMPORT_BLOB_SEGMENT 32768       // written to blob at once
+
+// rows decoded by reader thread, fieldcount values per row
+struct DecodedBatch
+{
+    int rows;
+    string data;                    // values copied from file, and blobs
+    vector<const char *> values;    // into data or into mapped file
+    vector<int> lengths;            // -1 = NULL
+    vector<size_t> at;              // offset in data, npos if not copied
+};
+
+// state shared by reader and executing thread. Batches go around: free ->
+// reader -> decoded -> executor -> free
+struct ImportPipe
+{
+    std::mutex lock;
+    std::condition_variable decoded;    // batch decoded, or reading ended
+    std::condition_variable released;   // batch is free again, or stopped
+    std::deque<DecodedBatch *> free;
+    std::deque<DecodedBatch *> full;
+    DecodedBatch ring[IMPORT_PIPE_DEPTH];
+    bool reading;
+    bool corrupt;                   // reader found bad data
+    bool stopped;                   // executor does not want more rows
+};
+
+static DecodedBatch *takeFree(ImportPipe& pipe)
+{
+    std::unique_lock<std::mutex> guard(pipe.lock);
+    while (pipe.free.empty() && !pipe.stopped)
+        pipe.released.wait(guard);
+    if (pipe.stopped)
+        return 0;
+    DecodedBatch *b = pipe.free.front();
+    pipe.free.pop_front();
+    return b;
+}
+
+// returns 0 when all rows were read
+static DecodedBatch *takeDecoded(ImportPipe& pipe)
+{
+    std::unique_lock<std::mutex> guard(pipe.lock);
+    while (pipe.full.empty() && pipe.reading)
+        pipe.decoded.wait(guard);
+    if (pipe.full.empty())
+        return 0;
+    DecodedBatch *b = pipe.full.front();
+    pipe.full.pop_front();
+    return b;
+}
+
+static void releaseBatch(ImportPipe& pipe, DecodedBatch *b)
+{
+    std::lock_guard<std::mutex> guard(pipe.lock);
+    pipe.free.push_back(b);
+    pipe.released.notify_one();
+}
+
+// reads one row of file (row layout) into batch. Values are not converted,
+// blob segments are joined together. Returns false at the end of file or
+// if file is corrupt, then corrupt is set
+bool FBExport::DecodeRow(InputSource& in, IBPP::SDT *ft, DecodedBatch& b,
+    bool& corrupt)
+{
+    bool mapped = in.Mapped();
+    size_t base = (size_t)b.rows * fieldcount;
+    b.values.resize(base + fieldcount);
+    b.lengths.resize(base + fieldcount);
+    b.at.resize(base + fieldcount);
+    for (int i=0; i<fieldcount; i++)
+    {
+        size_t k = base + i;
+        b.at[k] = string::npos;
+        if (ft[i] == IBPP::sdBlob)
+        {
+            int len = in.Get();
+            if (len == EOF)         // blob could be the first field of a row
+                return false;
+            b.lengths[k] = -1;
+            if (len == 0)           // null value
+                continue;
+
+            bool needed = !Plan[i].params.empty();
+            b.at[k] = b.data.length();
+            while (true)
+            {
+                const char *temp = in.View(4);
+                if (!temp)
+                {
+                    Printf("\nFile seems corrupt (reason 1), bailing out...\n");
+                    corrupt = true;
+                    return false;
+                }
+                len = segmentLength(temp);
+                if (len < 0)
+                {
+                    Printf("\nFile seems corrupt (reason 2), bailing out...\n");
+                    corrupt = true;
+                    return false;
+                }
+                if (len == 0)       // end of blob data
+                    break;
+                const char *buffer = in.View(len);
+                if (!buffer)
+                {
+                    Printf("\nFile seems corrupt (reason 3), bailing out...\n");
+                    corrupt = true;
+                    return false;
+                }
+                if (needed)
+                    b.data.append(buffer, len);
+            }
+            b.lengths[k] = (int)(b.data.length() - b.at[k]);
+            continue;
+        }
+
+        int size = in.Get();
+        if (size == EOF)
+            return false;
+        if (size == 255)
+        {
+            b.lengths[k] = -1;
+            continue;
+        }
+        if (size == 254)    // size > 253, read it
+        {
+            int first = in.Get();
+            int second = in.Get();
+            size = first * 256 + second;
+        }
+        const char *value = in.View(size);
+        if (!value)
+        {
+            Printf("\nFile seems corrupt (reason 5), bailing out...\n");
+            corrupt = true;
+            return false;
+        }
+        b.lengths[k] = size;
+        if (mapped)
+            b.values[k] = value;
+        else
+        {
+            b.at[k] = b.data.length();
+            b.data.append(value, size);
+        }
+    }
+    b.rows++;
+    return true;
+}
+
+// reader thread: decodes rows into free batches of the ring until the end
+// of file, or until executor stops
+void FBExport::DecodeRows(ImportPipe *pipe, InputSource *in, IBPP::SDT *ft)
+{
+    while (true)
+    {
+        DecodedBatch *b = takeFree(*pipe);
+        if (!b)
+            return;
+        b->rows = 0;
+        b->data.erase();
+        bool more = true;
+        bool corrupt = false;
+        while (b->rows < IMPORT_PIPE_ROWS
+            && (more = DecodeRow(*in, ft, *b, corrupt)))
+        {
+        }
+        for (size_t k = 0; k < (size_t)b->rows * fieldcount; k++)
+            if (b->at[k] != string::npos)   // data is not moved any more
+                b->values[k] = b->data.data() + b->at[k];
+
+        std::lock_guard<std::mutex> guard(pipe->lock);
+        if (b->rows > 0)
+            pipe->full.push_back(b);
+        else
+            pipe->free.push_back(b);
+        if (!more)
+        {
+            pipe->reading = false;
+            pipe->corrupt = corrupt;
+        }
+        pipe->decoded.notify_one();
+        if (!more)
+            return;
+    }
+}
+
+// creates blob from value decoded by reader thread
+void FBExport::BindBlob(IBPP::Statement& st, int col, const char *data, int len)
+{
+    vector<int>& params = Plan[col].params;
+    if (len < 0)
+    {
+        for (size_t j = 0; j < params.size(); j++)
+            st->SetNull(params[j]);
+        return;
+    }
+
+    IBPP::Blob b = IBPP::BlobFactory(st->DatabasePtr(), st->TransactionPtr());
+    b->Create();
+    for (int pos = 0; pos < len; pos += IMPORT_BLOB_SEGMENT)
+        b->Write(data + pos, len - pos < IMPORT_BLOB_SEGMENT ? len - pos : IMPORT_BLOB_SEGMENT);
+    b->Close();
+    for (size_t j = 0; j < params.size(); j++)
+        st->Set(params[j], b);
+}
+
+// stops reader thread and waits for it
+static void stopPipe(ImportPipe& pipe, std::thread& reader)
+{
+    {
+        std::lock_guard<std::mutex> guard(pipe.lock);
+        pipe.stopped = true;
+        pipe.released.notify_all();
+    }
+    reader.join();
+}
+
+// same as ImportRows(), but rows are decoded from file by a reader thread,
+// into a ring of batches, while this thread binds and executes rows decoded
+// before. Reading of file and waiting for server overlap
+// returns number of rows inserted, or -1 if error
+int FBExport::ImportPipeline(IBPP::Statement& st, InputSource& in, IBPP::SDT *ft,
+    ImportBatch *batch)
+{
+    ImportPipe pipe;
+    pipe.reading = true;
+    pipe.corrupt = false;
+    pipe.stopped = false;
+    for (int i = 0; i < IMPORT_PIPE_DEPTH; i++)
+        pipe.free.push_back(&pipe.ring[i]);
+    std::thread reader(&FBExport::DecodeRows, this, &pipe, &in, ft);
+
+    int Errors = 0;
+    bool binary = (FileVersion >= FBEXPORT_FILE_VERSION);
+
+    // values of rows queued in batch, their decoded batches are held until
+    // it is executed
+    int slots = (batch ? batch->capacity : 1);
+    vector<string> rowData(slots);              // CurrentData of text rows
+    vector<int> fieldLen(slots * fieldcount);
+    vector<const char *> fieldPtr(slots * fieldcount);
+    vector<DecodedBatch *> held;
+    int slot = 0;
+
+    int ret = 0;    // number of rows entered - counter
+    bool stop = false;
+    try
+    {
+        DecodedBatch *d;
+        while (!stop && (d = takeDecoded(pipe)) != 0)
+        {
+            for (int r = 0; r < d->rows && !stop; r++)
+            {
+                const char **values = &d->values[r * fieldcount];
+                const int *lengths = &d->lengths[r * fieldcount];
+                bool ErrorInHere = false;
+                if (!binary)
+                {
+                    CurrentData = "";
+                    for (int i=0; i<fieldcount; i++)
+                    {
+                        if (ft[i] == IBPP::sdBlob)
+                            continue;
+                        if (i)
+                            CurrentData += ",";
+                        if (lengths[i] < 0)
+                            CurrentData += "[null]";
+                        else
+                            CurrentData.append(values[i], lengths[i]);
+                    }
+                }
+
+                for (int i=0; i<fieldcount && !ErrorInHere; i++)
+                {
+                    if (Plan[i].params.empty())     // we don't need this field
+                        continue;
+                    try
+                    {
+                        if (ft[i] == IBPP::sdBlob)
+                            BindBlob(st, i, values[i], lengths[i]);
+                        else if (lengths[i] < 0)
+                        {
+                            vector<int>& params = Plan[i].params;
+                            for (size_t j = 0; j < params.size(); j++)
+                                st->SetNull(params[j]);
+                        }
+                        else if (binary)
+                            BinaryToNumParams(values[i], lengths[i], st, i+1);
+                        else
+                        {
+                            StringToNumParams(string(values[i], lengths[i]),
+                                st, i+1, ft[i]);
+                        }
+                    }
+                    catch(IBPP::Exception &e)
+                    {
+                        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                        Printf("\nCurrent field: %d of %d.\n", i+1, fieldcount);
+                        ErrorInHere = true;
+                    }
+                }
+
+                if (!ErrorInHere && batch)
+                {
+                    if (!binary)
+                        rowData[slot].swap(CurrentData);
+                    for (int i=0; i<fieldcount; i++)
+                    {
+                        fieldPtr[slot * fieldcount + i] = values[i];
+                        fieldLen[slot * fieldcount + i] = lengths[i];
+                    }
+                    slot++;
+                    if (QueueRow(st, batch))
+                    {
+                        stop = FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen);
+                        slot = 0;
+                        for (size_t h = 0; h < held.size(); h++)
+                            releaseBatch(pipe, held[h]);
+                        held.clear();
+                    }
+                    continue;
+                }
+
+                if (!ErrorInHere)
+                {
+                    try
+                    {
+                        st->Execute();
+                        ret++;          // increase row counter
+                    }
+                    catch (IBPP::Exception &e)
+                    {
+                        Printf("\nIBPP Error: %s\n", e.ErrorMessage());
+                        ErrorInHere = true;
+                    }
+                }
+
+                if (ErrorInHere)
+                {
+                    if (binary)
+                        BinaryRowData(ft, values, lengths);
+                    if (RowFailed(Errors))
+                        stop = true;
+                }
+
+                if (!batch)
+                    ImportCheckpoint(st, ret, ret - 1);
+            }
+
+            if (slot == 0)
+            {
+                releaseBatch(pipe, d);
+                continue;
+            }
+            held.push_back(d);
+            if (!stop && held.size() >= IMPORT_PIPE_DEPTH - 1)
+            {
+                // failed rows kept the batch from filling up, execute
+                // what is queued so the reader has room
+                stop = FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen);
+                slot = 0;
+                for (size_t h = 0; h < held.size(); h++)
+                    releaseBatch(pipe, held[h]);
+                held.clear();
+            }
+        }
+
+        bool corrupt;       // reader might still be running if we stopped
+        {
+            std::lock_guard<std::mutex> guard(pipe.lock);
+            corrupt = pipe.corrupt;
+        }
+        if (corrupt)
+            ret = -1;
+        else if (batch && slot > 0 && !stop)    // the rest of rows
+            FlushBatch(st, batch, ft, ret, Errors, rowData, fieldPtr, fieldLen);
+    }
+    catch (...)
+    {
+        stopPipe(pipe, reader);
+        throw;
+    }
+    stopPipe(pipe, reader);
+    return ret;
+}
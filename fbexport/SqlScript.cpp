@@ -0,0 +1,278 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : SqlScript.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Implementation of SQL script reader
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifdef IBPP_LINUX
+#include <strings.h>
+#define strnicmp(a, b, c) strncasecmp( (a), (b), (c) )
+#endif
+
+#include <ctype.h>
+#include <string.h>
+#include "SqlScript.h"
+
+SqlScript::SqlScript(FILE *fp)
+    : inM(fp), blockM(0), lenM(0), posM(0), blockOffsetM(0), lineM(1),
+    offsetM(0), statementLineM(0)
+{
+    SetTerm(";");
+}
+
+void SqlScript::SetTerm(const std::string& term)
+{
+    termM = term;
+    memset(specialM, 0, sizeof(specialM));
+    const char *special = "\n'\"-/qQ";
+    for (const char *p = special; *p; p++)
+        specialM[(unsigned char)*p] = true;
+    specialM[(unsigned char)termM[0]] = true;
+}
+
+bool SqlScript::Fill()
+{
+    blockOffsetM += lenM;
+    posM = 0;
+    blockM = inM.ViewBlock(lenM);
+    return lenM > 0;
+}
+
+int SqlScript::Peek()
+{
+    if (posM == lenM && !Fill())
+        return EOF;
+    return (unsigned char)blockM[posM];
+}
+
+bool SqlScript::StartsWith(const std::string& sql, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    if (sql.length() < len || strnicmp(sql.c_str(), keyword, len) != 0)
+        return false;
+    return sql.length() == len || !(isalnum((unsigned char)sql[len])
+        || sql[len] == '_' || sql[len] == '$');
+}
+
+bool SqlScript::IsDDL(const std::string& sql)
+{
+    static const char *ddl[] = { "CREATE", "ALTER", "DROP", "RECREATE",
+        "GRANT", "REVOKE", "COMMENT", 0 };
+    for (const char **k = ddl; *k; k++)
+        if (StartsWith(sql, *k))
+            return true;
+    return false;
+}
+
+bool SqlScript::NoResultSet(const std::string& sql)
+{
+    if (IsDDL(sql))
+        return true;
+
+    static const char *dml[] = { "INSERT", "UPDATE", "DELETE", "MERGE", 0 };
+    for (const char **k = dml; *k; k++)
+    {
+        if (!StartsWith(sql, *k))
+            continue;
+        // RETURNING gives a row. It is looked for even inside of strings,
+        // as taking the slow path by mistake does no harm
+        for (size_t i = 0; i + 9 <= sql.length(); i++)
+            if (strnicmp(sql.c_str() + i, "RETURNING", 9) == 0)
+                return false;
+        return true;
+    }
+    return false;
+}
+
+// SET TERM is a command of isql, it is not sent to server
+bool SqlScript::IsSetTerm(const std::string& sql)
+{
+    if (!StartsWith(sql, "SET"))
+        return false;
+    size_t p = sql.find_first_not_of(" \t\r\n", 3);
+    if (p == std::string::npos || p == 3 || !StartsWith(sql.substr(p), "TERM"))
+        return false;
+    size_t start = sql.find_first_not_of(" \t\r\n", p + 4);
+    if (start == std::string::npos || start == p + 4)
+        return false;
+    size_t end = sql.find_first_of(" \t\r\n", start);
+    if (end != std::string::npos && sql.find_first_not_of(" \t\r\n", end) != std::string::npos)
+        return false;
+    SetTerm(sql.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    return true;
+}
+
+bool SqlScript::Next(std::string& sql)
+{
+    sql.clear();
+    bool started = false;       // seen something besides whitespace
+    while (true)
+    {
+        if (posM == lenM && !Fill())
+        {
+            if (!started)
+                return false;
+            size_t end = sql.find_last_not_of(" \t\r\n");
+            sql.erase(end + 1);
+            if (IsSetTerm(sql))     // last line of script
+                return false;
+            return true;
+        }
+
+        // copy plain text up to the next character that needs attention
+        size_t start = posM;
+        while (posM < lenM && !specialM[(unsigned char)blockM[posM]])
+            posM++;
+        if (posM > start)
+        {
+            if (!started)
+            {
+                while (start < posM && isspace((unsigned char)blockM[start]))
+                    start++;
+                if (start < posM)
+                {
+                    started = true;
+                    offsetM = blockOffsetM + start;
+                    statementLineM = lineM;
+                }
+            }
+            sql.append(blockM + start, posM - start);
+            continue;
+        }
+
+        char c = blockM[posM++];
+        if (c == '\n')
+        {
+            lineM++;
+            if (started)
+                sql += c;
+            continue;
+        }
+
+        if (c == '-' && Peek() == '-')      // comment till end of line
+        {
+            while (posM < lenM || Fill())
+            {
+                if (blockM[posM] == '\n')
+                    break;
+                posM++;
+            }
+            continue;
+        }
+        if (c == '/' && Peek() == '*')
+        {
+            posM++;
+            char prev = 0;
+            while (posM < lenM || Fill())
+            {
+                c = blockM[posM++];
+                if (c == '/' && prev == '*')
+                    break;
+                if (c == '\n')
+                    lineM++;
+                prev = c;
+            }
+            if (started)
+                sql += ' ';     // keep tokens apart
+            continue;
+        }
+
+        if (!started)
+        {
+            started = true;
+            offsetM = blockOffsetM + posM - 1;
+            statementLineM = lineM;
+        }
+
+        if (c == termM[0])
+        {
+            size_t matched = 1;
+            while (matched < termM.length() && Peek() == (unsigned char)termM[matched])
+            {
+                posM++;
+                matched++;
+            }
+            if (matched < termM.length())
+            {
+                sql.append(termM, 0, matched);
+                continue;
+            }
+            size_t end = sql.find_last_not_of(" \t\r\n");
+            if (end == std::string::npos)   // empty statement
+            {
+                sql.clear();
+                started = false;
+                continue;
+            }
+            sql.erase(end + 1);
+            if (IsSetTerm(sql))
+            {
+                sql.clear();
+                started = false;
+                continue;
+            }
+            return true;
+        }
+
+        sql += c;
+        char close = 0;
+        if (c == '\'' || c == '"')
+            close = c;
+        else if ((c == 'q' || c == 'Q') && Peek() == '\''  // q'{...}'
+            && (sql.length() == 1 || !(isalnum((unsigned char)sql[sql.length() - 2])
+            || sql[sql.length() - 2] == '_' || sql[sql.length() - 2] == '$')))
+        {
+            sql += blockM[posM++];
+            int delimiter = Peek();
+            if (delimiter == EOF)
+                continue;
+            sql += blockM[posM++];
+            switch (delimiter)
+            {
+                case '(':   close = ')';    break;
+                case '{':   close = '}';    break;
+                case '[':   close = ']';    break;
+                case '<':   close = '>';    break;
+                default:    close = (char)delimiter;
+            }
+        }
+        if (!close)
+            continue;
+
+        // quoted text is copied as it is, a doubled quote just looks like
+        // two strings next to each other
+        bool qstring = (c != close);
+        while (posM < lenM || Fill())
+        {
+            c = blockM[posM++];
+            sql += c;
+            if (c == '\n')
+                lineM++;
+            if (c == close && (!qstring || Peek() == '\''))
+            {
+                if (qstring)
+                    sql += blockM[posM++];
+                break;
+            }
+        }
+    }
+}
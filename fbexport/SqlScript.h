@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : SqlScript.h
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Reads statements of SQL script (-X) in a single pass.
+//                Knows about quoted strings, comments and SET TERM
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef SqlScriptH
+#define SqlScriptH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "InputSource.h"
+
+class SqlScript
+{
+private:
+    InputSource inM;
+    const char *blockM;         // current block of input
+    size_t lenM;
+    size_t posM;
+    int64_t blockOffsetM;       // file offset of blockM
+    int lineM;
+    std::string termM;          // statement terminator, ; unless SET TERM
+    bool specialM[256];         // characters that stop the plain text scan
+
+    int64_t offsetM;            // where the last statement starts
+    int statementLineM;
+
+    bool Fill();
+    int Peek();
+    void SetTerm(const std::string& term);
+    bool IsSetTerm(const std::string& sql);
+
+    // no copying
+    SqlScript(const SqlScript&);
+    SqlScript& operator=(const SqlScript&);
+
+public:
+    SqlScript(FILE *fp);
+
+    // reads next statement without its terminator and comments. Returns
+    // false at end of script. Text after the last terminator is returned as
+    // a statement if it is not empty
+    bool Next(std::string& sql);
+
+    // position of first character of the statement returned by Next()
+    int64_t Offset() const { return offsetM; }
+    int Line() const { return statementLineM; }
+
+    // true if sql starts with given keyword (in uppercase)
+    static bool StartsWith(const std::string& sql, const char *keyword);
+    // true for statements that change metadata
+    static bool IsDDL(const std::string& sql);
+    // true for DML and DDL that never returns rows. Such statements can be
+    // run with ExecuteImmediate, without preparing and describing them
+    static bool NoResultSet(const std::string& sql);
+};
+
+#endif
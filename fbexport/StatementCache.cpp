@@ -0,0 +1,249 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  File        : StatementCache.cpp
+//  Author      : Milan Babuskov (mbabuskov@yahoo.com)
+//  Purpose     : Cache of prepared INSERTs for -X scripts (--stmt-cache).
+//                Literals of VALUES are taken out as parameters, so rows of
+//                the same table share one prepared statement
+//
+///////////////////////////////////////////////////////////////////////////////
+//
+//  The contents of this file are subject to the Mozilla Public License
+//  Version 1.0 (the "License"); you may not use this file except in
+//  compliance with the License. You may obtain a copy of the License at
+//  http://www.mozilla.org/MPL/
+//
+//  Software distributed under the License is distributed on an "AS IS"
+//  basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+//  License for the specific language governing rights and limitations
+//  under the License.
+//
+//  The Original Code is "FBExport 1.0" and all its associated documentation.
+//
+//  The Initial Developer of the Original Code is Milan Babuskov.
+//
+//  Contributor(s): ______________________________________.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "ibpp.h"
+
+#ifdef HAS_HDRSTOP
+#pragma hdrstop
+#endif
+
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+
+#include "ParseArgs.h"
+#include "FBExport.h"
+#include "SqlScript.h"
+
+// value taken out of statement
+struct Literal
+{
+    string text;                // without quotes
+    bool quoted;
+};
+
+// length of numeric literal at sql[i] (i.e. -12.5e3), 0 if there is none
+static size_t numberLength(const string& sql, size_t i)
+{
+    size_t start = i, n = sql.length();
+    if (i < n && (sql[i] == '-' || sql[i] == '+'))
+        i++;
+    size_t digits = 0;
+    while (i < n && isdigit((unsigned char)sql[i]))
+        i++, digits++;
+    if (i < n && sql[i] == '.')
+        for (i++; i < n && isdigit((unsigned char)sql[i]); i++)
+            digits++;
+    if (digits == 0)
+        return 0;
+    if (i < n && (sql[i] == 'e' || sql[i] == 'E'))
+    {
+        size_t e = i + 1;
+        if (e < n && (sql[e] == '-' || sql[e] == '+'))
+            e++;
+        if (e == n || !isdigit((unsigned char)sql[e]))
+            return 0;
+        for (i = e; i < n && isdigit((unsigned char)sql[i]); i++)
+            ;
+    }
+    return i - start;
+}
+
+// length of string literal at sql[i], quotes included. Its value is appended
+// to text. 0 if the string is not closed
+static size_t stringLength(const string& sql, size_t i, string& text)
+{
+    size_t start = i++;
+    for (; i < sql.length(); i++)
+    {
+        if (sql[i] != '\'')
+            text += sql[i];
+        else if (i + 1 < sql.length() && sql[i + 1] == '\'')
+            text += sql[i++];
+        else
+            return i + 1 - start;
+    }
+    return 0;
+}
+
+static bool isNameChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+// INSERT ... VALUES (...) with each value that is a plain literal replaced by
+// ?. Expressions are left as they are. False if no value was taken out
+static bool liftLiterals(const string& sql, string& shape, vector<Literal>& values)
+{
+    shape.clear();
+    values.clear();
+    if (!SqlScript::StartsWith(sql, "INSERT"))
+        return false;
+
+    int depth = 0;
+    bool inValues = false;
+    char prev = 0;              // last character of shape that is not space
+    size_t i = 0, n = sql.length();
+    while (i < n)
+    {
+        char c = sql[i];
+        if (c == '"')           // quoted name
+        {
+            size_t end = sql.find('"', i + 1);
+            if (end == string::npos)
+                return false;
+            shape.append(sql, i, end + 1 - i);
+            i = end + 1;
+            prev = '"';
+            continue;
+        }
+
+        if (inValues && depth == 1 && (prev == '(' || prev == ','))
+        {
+            Literal v;
+            size_t len;
+            if (c == '\'')
+                len = stringLength(sql, i, v.text);
+            else
+            {
+                len = numberLength(sql, i);
+                v.text.assign(sql, i, len);
+            }
+            size_t next = sql.find_first_not_of(" \t\r\n", i + len);
+            if (len > 0 && next != string::npos && (sql[next] == ',' || sql[next] == ')'))
+            {
+                v.quoted = (c == '\'');
+                values.push_back(v);
+                shape += '?';
+                prev = '?';
+                i += len;
+                continue;
+            }
+        }
+
+        if (c == '\'')          // string that is part of expression
+        {
+            string dummy;
+            size_t len = stringLength(sql, i, dummy);
+            if (len == 0)
+                return false;
+            shape.append(sql, i, len);
+            i += len;
+            prev = '\'';
+            continue;
+        }
+        if (c == '(')
+            depth++;
+        else if (c == ')')
+            depth--;
+        else if (!inValues && depth == 0 && (i == 0 || !isNameChar(sql[i - 1]))
+            && SqlScript::StartsWith(sql.substr(i, 7), "VALUES"))
+        {
+            inValues = true;
+        }
+        shape += c;
+        if (!isspace((unsigned char)c))
+            prev = c;
+        i++;
+    }
+    return !values.empty();
+}
+
+// Runs INSERT through prepared statement from cache. Returns false if the
+// statement is not suitable, caller should execute it as it is then
+bool FBExport::ExecuteCached(IBPP::Database db, IBPP::Transaction& tr, const string& sql)
+{
+    if (SqlScript::IsDDL(sql))      // cached statements might not be valid any more
+    {
+        Cache.clear();
+        CacheOrder.clear();
+        return false;
+    }
+
+    string shape;
+    vector<Literal> values;
+    if (!liftLiterals(sql, shape, values))
+        return false;
+
+    map<string, CachedStatement>::iterator it = Cache.find(shape);
+    if (it == Cache.end())
+    {
+        CachedStatement c;
+        try
+        {
+            c.st = IBPP::StatementFactory(db, tr);
+            c.st->Prepare(shape);
+            if (c.st->Parameters() != (int)values.size())
+                c.st.clear();
+            for (int i = 1; c.st.intf() && i <= c.st->Parameters(); i++)
+            {
+                c.types.push_back(c.st->ParameterType(i));
+                c.scales.push_back(c.st->ParameterScale(i));
+                c.sizes.push_back(c.st->ParameterSize(i));
+            }
+        }
+        catch (IBPP::Exception&)    // reported when run without cache
+        {
+            c.st.clear();
+        }
+
+        CacheOrder.push_front(shape);
+        c.age = CacheOrder.begin();
+        it = Cache.insert(make_pair(shape, c)).first;
+        if ((int)Cache.size() > ar->StmtCache)
+        {
+            Cache.erase(CacheOrder.back());
+            CacheOrder.pop_back();
+        }
+    }
+    else
+        CacheOrder.splice(CacheOrder.begin(), CacheOrder, it->second.age);
+
+    CachedStatement& c = it->second;
+    if (c.st.intf() == 0)
+        return false;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        Literal& v = values[i];
+        IBPP::SDT type = c.types[i];
+        if (type == IBPP::sdString || type == IBPP::sdBlob)
+        {
+            // server would format numbers its own way, and report strings
+            // that are too long
+            if (!v.quoted || (type == IBPP::sdString && (int)v.text.length() > c.sizes[i]))
+                return false;
+        }
+        // server reads date literals in more formats than -J and -K
+        if (type == IBPP::sdDate || type == IBPP::sdTime || type == IBPP::sdTimestamp)
+            return false;
+        if (!BindTextParam(c.st, i + 1, type, c.scales[i], v.text.data(), (int)v.text.length()))
+            return false;
+    }
+    c.st->Execute();
+    return true;
+}
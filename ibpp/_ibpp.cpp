@@ -250,6 +250,7 @@ GDS* GDS::Call()
 		IB_ENTRYPOINT(que_events);
 		IB_ENTRYPOINT(cancel_events);
 		IB_ENTRYPOINT(start_multiple);
+		IB_ENTRYPOINT(transaction_info);
 		IB_ENTRYPOINT(commit_transaction);
 		IB_ENTRYPOINT(commit_retaining);
 		IB_ENTRYPOINT(rollback_transaction);
@@ -59,6 +59,14 @@
 #include <windows.h>
 #endif
 
+//	Firebird 4 items, not known to older ibase.h
+#ifndef isc_tpb_at_snapshot_number
+#define isc_tpb_at_snapshot_number		23
+#endif
+#ifndef fb_info_tra_snapshot_number
+#define fb_info_tra_snapshot_number		12
+#endif
+
 #include <limits>
 #include <cstring>
 #include <string>
@@ -258,6 +266,13 @@ typedef ISC_STATUS  ISC_EXPORT proto_start_multiple (ISC_STATUS *,
 					   short,
 					   void *);
 
+typedef ISC_STATUS  ISC_EXPORT proto_transaction_info (ISC_STATUS *,
+					   isc_tr_handle *,
+					   short,
+					   char *,
+					   short,
+					   char *);
+
 typedef ISC_STATUS  ISC_EXPORT proto_commit_transaction (ISC_STATUS *,
 					       isc_tr_handle *);
 
@@ -427,6 +442,7 @@ struct GDS
 	proto_que_events*				m_que_events;
 	proto_cancel_events* 			m_cancel_events;
 	proto_start_multiple*			m_start_multiple;
+	proto_transaction_info*			m_transaction_info;
 	proto_commit_transaction*		m_commit_transaction;
 	proto_commit_retaining*			m_commit_retaining;
 	proto_rollback_transaction*		m_rollback_transaction;
@@ -929,6 +945,8 @@ public:
     void DetachDatabase(IBPP::Database db);
 	void AddReservation(IBPP::Database db,
 			const std::string& table, IBPP::TTR tr);
+	void AtSnapshotNumber(IBPP::Database db, int64_t number);
+	int64_t SnapshotNumber();
 
     void Start();
 	bool Started() { return mHandle == 0 ? false : true; }
@@ -982,6 +1000,7 @@ public:
 
 public:
 	void SetNull(int);
+	void CopyValue(int, const RowImpl&, int);
 	void Set(int, bool);
 	void Set(int, const char*);				// c-strings
 	void Set(int, const void*, int);		// byte buffers
@@ -997,12 +1016,15 @@ public:
 	void Set(int, const IBPP::DBKey&);
 	void Set(int, const IBPP::Blob&);
 	void Set(int, const IBPP::Array&);
+	void SetRaw(int, const void*, int);
 
 	bool IsNull(int);
 	bool Get(int, bool&);
 	bool Get(int, char*);  		// c-strings, len unchecked
 	bool Get(int, void*, int&);	// byte buffers
 	bool Get(int, std::string&);
+	bool GetString(int, const char*&, int& len, bool trim);
+	bool GetRaw(int, const void*&, int& len);
 	bool Get(int, int16_t&);
 	bool Get(int, int32_t&);
 	bool Get(int, int64_t&);
@@ -1099,6 +1121,8 @@ public:
 	inline void CursorExecute(const std::string& cursor)	{ CursorExecute(cursor, std::string()); }
 	bool Fetch();
 	bool Fetch(IBPP::Row&);
+	IBPP::Row CurrentRow();
+	int FetchBlock(IBPP::RowBlock&, int maxRows);
 	int AffectedRows();
 	void Close();	// Free resources, attachments maintained
 	std::string& Sql() { return mSql; }
@@ -1120,6 +1144,8 @@ public:
 	void Set(int, const IBPP::DBKey&);
 	void Set(int, const IBPP::Blob&);
 	void Set(int, const IBPP::Array&);
+	void SetRaw(int, const void*, int);
+	void CopyParameter(int, IBPP::Statement&, int);
 
 	bool IsNull(int);
 	bool Get(int, bool*);
@@ -1127,6 +1153,8 @@ public:
 	bool Get(int, char*);				// c-strings, len unchecked
 	bool Get(int, void*, int&);			// byte buffers
 	bool Get(int, std::string&);
+	bool GetString(int, const char*&, int& len, bool trim);
+	bool GetRaw(int, const void*&, int& len);
 	bool Get(int, int16_t*);
 	bool Get(int, int16_t&);
 	bool Get(int, int32_t*);
@@ -1143,6 +1171,7 @@ public:
 	bool Get(int, IBPP::DBKey&);
 	bool Get(int, IBPP::Blob&);
 	bool Get(int, IBPP::Array&);
+	bool Get(const IBPP::RowBlock&, int, int row, IBPP::Blob&);
 
 	bool IsNull(const std::string&);
 	bool Get(const std::string&, bool*);
@@ -1199,6 +1228,7 @@ class BlobImpl : public IBPP::IBlob
 
 private:
 	friend class RowImpl;
+	friend class StatementImpl;
 
 	int mRefCount;
 	bool					mIdAssigned;
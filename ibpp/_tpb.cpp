@@ -78,7 +78,7 @@ void TPB::Insert(const std::string& data)
 	int len = (int)data.length();
 	Grow(1 + len);
 	mBuffer[mSize++] = (char)len;
-	strncpy(&mBuffer[mSize], data.c_str(), len);
+	memcpy(&mBuffer[mSize], data.data(), len);		// data may be binary
 	mSize += len;
 }
 
@@ -390,6 +390,48 @@ namespace IBPP
 		~User() { };
 	};
 
+	/* Class RowBlock receives many rows at once from Statement::FetchBlock(),
+	 * stored column by column, so that they can be processed in tight loops.
+	 * Values of fixed size are arrays of native types : int16_t, int32_t,
+	 * int64_t, float, double. Date and Time are stored as the int values of
+	 * IBPP::Date and IBPP::Time, Timestamp as a pair of those. Blobs and arrays
+	 * are stored as their 8 bytes ids, see Statement::Get(RowBlock&, ...).
+	 * Strings of a column are stored one after another, with offsets. */
+
+	class RowBlock
+	{
+	public:
+		struct Column
+		{
+			SDT type;
+			int scale;
+			int width;						// Bytes per value, 0 for strings
+			std::vector<char> data;			// Values of all rows
+			std::vector<unsigned char> nulls;	// Bit (row % 8) of byte (row / 8)
+			std::vector<uint32_t> offsets;	// Strings only : value of row r is
+											// data[offsets[r]..offsets[r+1]-1]
+		};
+
+		int rows;						// Number of rows in block
+		bool eof;						// No more rows left after this block
+		std::vector<Column> columns;	// 1 based, columns[0] is not used
+
+		int Columns() const	{ return (int)columns.size() - 1; }
+		bool IsNull(int col, int row) const
+			{ return ((columns[col].nulls[row / 8] >> (row % 8)) & 1) != 0; }
+		template <class T> const T* Values(int col) const
+			{ return (const T*)columns[col].data.data(); }
+		const char* String(int col, int row, int& len) const
+		{
+			const Column& c = columns[col];
+			len = (int)(c.offsets[row + 1] - c.offsets[row]);
+			return c.data.data() + c.offsets[row];
+		}
+
+		RowBlock() : rows(0), eof(false) { }
+		~RowBlock() { };
+	};
+
 	//	Interface Wrapper
 	template <class T>
 	class Ptr
@@ -611,6 +653,11 @@ namespace IBPP
 	    virtual void DetachDatabase(Database db) = 0;
 	 	virtual void AddReservation(Database db,
 	 			const std::string& table, TTR tr) = 0;
+		//	Firebird 4 and up: transaction will see the same snapshot as the
+		//	(still active) transaction whose SnapshotNumber() is given.
+		//	SnapshotNumber() returns 0 if server doesn't support it.
+		virtual void AtSnapshotNumber(Database db, int64_t number) = 0;
+		virtual int64_t SnapshotNumber() = 0;
 
 		virtual void Start() = 0;
 		virtual bool Started() = 0;
@@ -648,11 +695,14 @@ namespace IBPP
 		virtual void Set(int, const DBKey&) = 0;
 		virtual void Set(int, const Blob&) = 0;
 		virtual void Set(int, const Array&) = 0;
+		virtual void SetRaw(int, const void*, int) = 0;		// native form, no conversion
 
 		virtual bool IsNull(int) = 0;
 		virtual bool Get(int, bool&) = 0;
 		virtual bool Get(int, void*, int&) = 0;	// byte buffers
 		virtual bool Get(int, std::string&) = 0;
+		virtual bool GetString(int, const char*&, int& len, bool trim) = 0;	// no copy
+		virtual bool GetRaw(int, const void*&, int& len) = 0;	// native form, no copy
 		virtual bool Get(int, int16_t&) = 0;
 		virtual bool Get(int, int32_t&) = 0;
 		virtual bool Get(int, int64_t&) = 0;
@@ -722,6 +772,8 @@ namespace IBPP
 		virtual void CursorExecute(const std::string& cursor, const std::string&) = 0;
 		virtual bool Fetch() = 0;
 		virtual bool Fetch(Row&) = 0;
+		virtual Row CurrentRow() = 0;	// the row last Fetch() went into
+		virtual int FetchBlock(RowBlock&, int maxRows) = 0;
 		virtual int AffectedRows() = 0;
 		virtual void Close() = 0;
 		virtual std::string& Sql() = 0;
@@ -743,11 +795,15 @@ namespace IBPP
 		virtual void Set(int, const DBKey& value) = 0;
 		virtual void Set(int, const Blob& value) = 0;
 		virtual void Set(int, const Array& value) = 0;
+		virtual void SetRaw(int, const void*, int) = 0;		// native form, no conversion
+		virtual void CopyParameter(int, Statement& source, int) = 0;	// value of other statement's parameter
 
 		virtual bool IsNull(int) = 0;
 		virtual bool Get(int, bool&) = 0;
 		virtual bool Get(int, void*, int&) = 0;	// byte buffers
 		virtual bool Get(int, std::string&) = 0;
+		virtual bool GetString(int, const char*&, int& len, bool trim) = 0;	// no copy
+		virtual bool GetRaw(int, const void*&, int& len) = 0;	// native form, no copy
 		virtual bool Get(int, int16_t&) = 0;
 		virtual bool Get(int, int32_t&) = 0;
 		virtual bool Get(int, int64_t&) = 0;
@@ -759,6 +815,7 @@ namespace IBPP
 		virtual bool Get(int, DBKey& value) = 0;
 		virtual bool Get(int, Blob& value) = 0;
 		virtual bool Get(int, Array& value) = 0;
+		virtual bool Get(const RowBlock&, int, int row, Blob&) = 0;	// Blob of block
 
 		virtual bool IsNull(const std::string&) = 0;
 		virtual bool Get(const std::string&, bool&) = 0;
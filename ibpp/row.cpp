@@ -59,6 +59,78 @@ void RowImpl::SetNull(int param)
 	mUpdated[param-1] = true;
 }
 
+// Copies value of a column of another row. Strings can be copied between
+// CHAR and VARCHAR, other types must have the same storage (and scale, for
+// integers). Data is copied as it is, without any conversion.
+void RowImpl::CopyValue(int param, const RowImpl& source, int sourceparam)
+{
+	if (mDescrArea == 0 || source.mDescrArea == 0)
+		throw LogicExceptionImpl("Row::CopyValue", _("The row is not initialized."));
+	if (param < 1 || param > mDescrArea->sqld
+		|| sourceparam < 1 || sourceparam > source.mDescrArea->sqld)
+		throw LogicExceptionImpl("Row::CopyValue", _("Variable index out of range."));
+
+	XSQLVAR* src = &(source.mDescrArea->sqlvar[sourceparam-1]);
+	if ((src->sqltype & 1) && *src->sqlind == -1)
+	{
+		SetNull(param);
+		return;
+	}
+
+	XSQLVAR* var = &(mDescrArea->sqlvar[param-1]);
+	int type = var->sqltype & ~1;
+	int srctype = src->sqltype & ~1;
+	if ((type == SQL_TEXT || type == SQL_VARYING)
+		&& (srctype == SQL_TEXT || srctype == SQL_VARYING))
+	{
+		if (srctype == SQL_VARYING)
+			SetValue(param, ivByte, src->sqldata+2, *(int16_t*)src->sqldata);
+		else
+			SetValue(param, ivByte, src->sqldata, src->sqllen);
+	}
+	else if (type == srctype && var->sqllen == src->sqllen
+		&& (var->sqlscale == src->sqlscale
+			|| (type != SQL_SHORT && type != SQL_LONG && type != SQL_INT64)))
+	{
+		memcpy(var->sqldata, src->sqldata, var->sqllen);
+		if (var->sqltype & 1) *var->sqlind = 0;
+	}
+	else throw LogicExceptionImpl("Row::CopyValue", _("Incompatible types."));
+	mUpdated[param-1] = true;
+}
+
+// Copies value given in native form of the parameter (as in XSQLVAR, i.e.
+// ISC_DATE for dates) without any conversion or range checking. Strings are
+// given without length prefix, for other types len must match the size
+void RowImpl::SetRaw(int param, const void* data, int len)
+{
+	if (mDescrArea == 0)
+		throw LogicExceptionImpl("Row::SetRaw", _("The row is not initialized."));
+	if (param < 1 || param > mDescrArea->sqld)
+		throw LogicExceptionImpl("Row::SetRaw", _("Variable index out of range."));
+
+	XSQLVAR* var = &(mDescrArea->sqlvar[param-1]);
+	switch (var->sqltype & ~1)
+	{
+		case SQL_TEXT :
+			if (len > var->sqllen) len = var->sqllen;
+			memcpy(var->sqldata, data, len);
+			memset(var->sqldata + len, ' ', var->sqllen - len);
+			break;
+		case SQL_VARYING :
+			if (len > var->sqllen) len = var->sqllen;
+			*(int16_t*)var->sqldata = (int16_t)len;
+			memcpy(var->sqldata+2, data, len);
+			break;
+		default :
+			if (len != var->sqllen)
+				throw LogicExceptionImpl("Row::SetRaw", _("Incompatible types."));
+			memcpy(var->sqldata, data, len);
+	}
+	if (var->sqltype & 1) *var->sqlind = 0;
+	mUpdated[param-1] = true;
+}
+
 void RowImpl::Set(int param, bool value)
 {
 	if (mDescrArea == 0)
@@ -306,6 +378,55 @@ bool RowImpl::Get(int column, std::string& retvalue)
 	return pvalue == 0 ? true : false;
 }
 
+// Points data to the string value in the row itself, without copying it.
+// It is valid until the next Fetch(). Optionally trailing spaces are not
+// included in len.
+bool RowImpl::GetString(int column, const char*& data, int& len, bool trim)
+{
+	if (mDescrArea == 0)
+		throw LogicExceptionImpl("Row::GetString", _("The row is not initialized."));
+
+	len = 0;
+	data = (const char*)GetValue(column, ivByte, &len);
+	if (data == 0)
+	{
+		len = 0;
+		return true;
+	}
+	if (trim)
+		while (len > 0 && data[len-1] == ' ') len--;
+	return false;
+}
+
+// Points data to the value in its native form (see SetRaw), without copying
+// it. It is valid until the next Fetch()
+bool RowImpl::GetRaw(int column, const void*& data, int& len)
+{
+	if (mDescrArea == 0)
+		throw LogicExceptionImpl("Row::GetRaw", _("The row is not initialized."));
+	if (column < 1 || column > mDescrArea->sqld)
+		throw LogicExceptionImpl("Row::GetRaw", _("Variable index out of range."));
+
+	XSQLVAR* var = &(mDescrArea->sqlvar[column-1]);
+	if ((var->sqltype & 1) && *var->sqlind == -1)
+	{
+		data = 0;
+		len = 0;
+		return true;
+	}
+	if ((var->sqltype & ~1) == SQL_VARYING)
+	{
+		len = *(int16_t*)var->sqldata;
+		data = var->sqldata + 2;
+	}
+	else
+	{
+		len = var->sqllen;
+		data = var->sqldata;
+	}
+	return false;
+}
+
 bool RowImpl::Get(int column, int16_t& retvalue)
 {
 	if (mDescrArea == 0)
@@ -367,8 +367,10 @@ void StatementImpl::ExecuteImmediate(const std::string& sql)
 	if (sql.empty())
 		throw LogicExceptionImpl("Statement::ExecuteImmediate", _("SQL statement can't be 0."));
 
+	// Only a cursor left open is closed. A statement prepared before stays
+	// prepared, so mixing both kinds of execution costs no new Prepare().
+	CursorFree();
 	IBS status;
-	Close();
     (*gds.Call()->m_dsql_execute_immediate)(status.Self(), mDatabase->GetHandlePtr(),
     	mTransaction->GetHandlePtr(), 0, const_cast<char*>(sql.c_str()),
     		short(mDatabase->Dialect()), 0);
@@ -473,6 +475,126 @@ bool StatementImpl::Fetch(IBPP::Row& row)
 	return true;
 }
 
+int StatementImpl::FetchBlock(IBPP::RowBlock& block, int maxRows)
+{
+	if (! mResultSetAvailable)
+		throw LogicExceptionImpl("Statement::FetchBlock",
+			_("No statement has been executed or no result set available."));
+	if (maxRows < 1)
+		throw LogicExceptionImpl("Statement::FetchBlock", _("maxRows must be > 0"));
+
+	// Prepare the columns, reusing memory of previous block
+	XSQLDA* da = mOutRow->Self();
+	int cols = da->sqld;
+	block.columns.resize(cols + 1);
+	for (int c = 1; c <= cols; c++)
+	{
+		IBPP::RowBlock::Column& col = block.columns[c];
+		col.type = mOutRow->ColumnType(c);
+		col.scale = mOutRow->ColumnScale(c);
+		switch (col.type)
+		{
+			case IBPP::sdString :	col.width = 0; break;
+			case IBPP::sdSmallint :	col.width = 2; break;
+			case IBPP::sdInteger :
+			case IBPP::sdFloat :
+			case IBPP::sdDate :
+			case IBPP::sdTime :		col.width = 4; break;
+			default :				col.width = 8; break;
+		}
+		col.nulls.assign((maxRows + 7) / 8, 0);
+		col.offsets.clear();
+		if (col.width != 0)
+			col.data.resize((size_t)maxRows * col.width);
+		else
+		{
+			col.data.clear();
+			col.offsets.push_back(0);
+		}
+	}
+
+	int rows = 0;
+	block.eof = false;
+	while (rows < maxRows)
+	{
+		IBS status;
+		int code = (*gds.Call()->m_dsql_fetch)(status.Self(), &mHandle, 1, da);
+		if (code == 100)	// This special code means "no more rows"
+		{
+			mResultSetAvailable = false;
+			mCursorOpened = true;
+			CursorFree();	// Free the explicit or implicit cursor/result-set
+			block.eof = true;
+			break;
+		}
+		if (status.Errors())
+		{
+			Close();
+			throw SQLExceptionImpl(status, "Statement::FetchBlock",
+				_("isc_dsql_fetch failed."));
+		}
+
+		// Copy the row just fetched into the columns
+		for (int c = 1; c <= cols; c++)
+		{
+			IBPP::RowBlock::Column& col = block.columns[c];
+			XSQLVAR* var = &(da->sqlvar[c-1]);
+			char* dest = (col.width == 0 ? 0 : &col.data[(size_t)rows * col.width]);
+			if ((var->sqltype & 1) && *(var->sqlind) != 0)
+			{
+				col.nulls[rows / 8] |= (unsigned char)(1 << (rows % 8));
+				if (dest != 0) memset(dest, 0, col.width);
+				else col.offsets.push_back(col.offsets.back());
+				continue;
+			}
+
+			switch (var->sqltype & ~1)
+			{
+				case SQL_TEXT :
+					col.data.insert(col.data.end(), var->sqldata, var->sqldata + var->sqllen);
+					col.offsets.push_back((uint32_t)col.data.size());
+					break;
+				case SQL_VARYING :
+					col.data.insert(col.data.end(), var->sqldata + 2,
+						var->sqldata + 2 + *(int16_t*)var->sqldata);
+					col.offsets.push_back((uint32_t)col.data.size());
+					break;
+				case SQL_TYPE_DATE :
+					{
+						IBPP::Date dt;
+						decodeDate(dt, *(ISC_DATE*)var->sqldata);
+						int32_t value = dt.GetDate();
+						memcpy(dest, &value, 4);
+					}
+					break;
+				case SQL_TIMESTAMP :
+					{
+						IBPP::Timestamp ts;
+						decodeTimestamp(ts, *(ISC_TIMESTAMP*)var->sqldata);
+						int32_t value[2] = { ts.GetDate(), ts.GetTime() };
+						memcpy(dest, value, 8);
+					}
+					break;
+				default :	// Native numbers, time, blob and array ids
+					memcpy(dest, var->sqldata, col.width);
+			}
+		}
+		rows++;
+	}
+
+	block.rows = rows;
+	return rows;
+}
+
+IBPP::Row StatementImpl::CurrentRow()
+{
+	if (mOutRow == 0)
+		throw LogicExceptionImpl("Statement::CurrentRow",
+			_("The row is not initialized."));
+
+	return mOutRow;
+}
+
 void StatementImpl::Close()
 {
 	// Free all statement resources.
@@ -646,6 +768,29 @@ void StatementImpl::Set(int param, const IBPP::Array& array)
 	mInRow->Set(param, array);
 }
 
+void StatementImpl::SetRaw(int param, const void* data, int len)
+{
+	if (mHandle == 0)
+		throw LogicExceptionImpl("Statement::SetRaw", _("No statement has been prepared."));
+	if (mInRow == 0)
+		throw LogicExceptionImpl("Statement::SetRaw", _("The statement does not take parameters."));
+
+	mInRow->SetRaw(param, data, len);
+}
+
+void StatementImpl::CopyParameter(int param, IBPP::Statement& source, int sourceparam)
+{
+	if (mHandle == 0)
+		throw LogicExceptionImpl("Statement::CopyParameter", _("No statement has been prepared."));
+	if (mInRow == 0)
+		throw LogicExceptionImpl("Statement::CopyParameter", _("The statement does not take parameters."));
+	StatementImpl* src = dynamic_cast<StatementImpl*>(source.intf());
+	if (src == 0 || src->mInRow == 0)
+		throw LogicExceptionImpl("Statement::CopyParameter", _("The source statement does not take parameters."));
+
+	mInRow->CopyValue(param, *src->mInRow, sourceparam);
+}
+
 void StatementImpl::Set(int param, const IBPP::DBKey& key)
 {
 	if (mHandle == 0)
@@ -718,6 +863,22 @@ bool StatementImpl::Get(int column, std::string& retvalue)
 	return mOutRow->Get(column, retvalue);
 }
 
+bool StatementImpl::GetString(int column, const char*& data, int& len, bool trim)
+{
+	if (mOutRow == 0)
+		throw LogicExceptionImpl("Statement::GetString", _("The row is not initialized."));
+
+	return mOutRow->GetString(column, data, len, trim);
+}
+
+bool StatementImpl::GetRaw(int column, const void*& data, int& len)
+{
+	if (mOutRow == 0)
+		throw LogicExceptionImpl("Statement::GetRaw", _("The row is not initialized."));
+
+	return mOutRow->GetRaw(column, data, len);
+}
+
 bool StatementImpl::Get(int column, int16_t* retvalue)
 {
 	if (mOutRow == 0)
@@ -856,6 +1017,23 @@ bool StatementImpl::Get(int column, IBPP::Array& array)
 	return mOutRow->Get(column, array);
 }
 
+bool StatementImpl::Get(const IBPP::RowBlock& block, int column, int row, IBPP::Blob& blob)
+{
+	if (column < 1 || column > block.Columns())
+		throw LogicExceptionImpl("Statement::Get", _("Variable index out of range."));
+	if (row < 0 || row >= block.rows)
+		throw LogicExceptionImpl("Statement::Get", _("Row index out of range."));
+	if (block.columns[column].type != IBPP::sdBlob)
+		throw LogicExceptionImpl("Statement::Get", _("Incompatible types."));
+	if (blob.intf() == 0)
+		throw LogicExceptionImpl("Statement::Get", _("Null pointer detected"));
+
+	if (block.IsNull(column, row)) return true;
+	BlobImpl* impl = (BlobImpl*)blob.intf();
+	impl->SetId((ISC_QUAD*)&block.columns[column].data[(size_t)row * 8]);
+	return false;
+}
+
 /*
 const IBPP::Value StatementImpl::Get(int column)
 {
@@ -112,6 +112,59 @@ void TransactionImpl::AddReservation(IBPP::Database db,
 			_("The database connection you specified is not attached to this transaction."));
 }
 
+void TransactionImpl::AtSnapshotNumber(IBPP::Database db, int64_t number)
+{
+	if (mHandle != 0)
+		throw LogicExceptionImpl("Transaction::AtSnapshotNumber",
+				_("Can't set snapshot number if Transaction started."));
+	if (db.intf() == 0)
+		throw LogicExceptionImpl("Transaction::AtSnapshotNumber",
+				_("Can't set snapshot number on an unbound Database."));
+	if (number <= 0)
+		throw LogicExceptionImpl("Transaction::AtSnapshotNumber",
+				_("Invalid snapshot number."));
+
+	std::vector<DatabaseImpl*>::iterator pos =
+		std::find(mDatabases.begin(), mDatabases.end(), dynamic_cast<DatabaseImpl*>(db.intf()));
+	if (pos == mDatabases.end())
+		throw LogicExceptionImpl("Transaction::AtSnapshotNumber",
+			_("The database connection you specified is not attached to this transaction."));
+
+	// Snapshot number is a length-prefixed little-endian integer
+	std::string data;
+	for (int i = 0; i < 8; i++)
+		data += (char)((uint64_t)number >> (8 * i));
+	TPB* tpb = mTPBs[pos - mDatabases.begin()];
+	tpb->Insert(isc_tpb_at_snapshot_number);
+	tpb->Insert(data);
+}
+
+int64_t TransactionImpl::SnapshotNumber()
+{
+	if (mHandle == 0)
+		throw LogicExceptionImpl("Transaction::SnapshotNumber", _("Transaction is not started."));
+
+	char item = fb_info_tra_snapshot_number;
+	char result[32];
+	IBS status;
+
+	(*gds.Call()->m_transaction_info)(status.Self(), &mHandle, 1, &item,
+		sizeof(result), result);
+	if (status.Errors())
+		throw SQLExceptionImpl(status, "Transaction::SnapshotNumber");
+
+	// Older servers answer with isc_info_error for items they don't know
+	if (result[0] != fb_info_tra_snapshot_number)
+		return 0;
+	int len = (unsigned char)result[1] | ((unsigned char)result[2] << 8);
+	if (len < 1 || len > 8)
+		return 0;
+	uint64_t number = 0;
+	for (int i = len - 1; i >= 0; i--)
+		number = (number << 8) | (unsigned char)result[3 + i];
+	return (int64_t)number;
+}
+
 void TransactionImpl::Start()
 {
 	if (mHandle != 0) return;	// Already started anyway